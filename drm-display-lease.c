@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2026 Paul Kocialkowski <contact@paulk.fr>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <fcntl.h>
+
+#include <xf86drmMode.h>
+#include <xf86drm.h>
+
+#include <drm-display.h>
+#include <drm-display-lease.h>
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+int drm_display_lease_create(struct drm_display *display,
+			     struct drm_display_lease *lease)
+{
+	struct drm_display_plane_setup *plane_setups[3];
+	unsigned int i;
+	int fd;
+
+	if (!display || !lease)
+		return -EINVAL;
+
+	plane_setups[0] = &display->primary_setup;
+	plane_setups[1] = &display->overlay_setup;
+	plane_setups[2] = &display->cursor_setup;
+
+	if (!display->output.connector_id || !display->output.crtc_id)
+		return -ENODEV;
+
+	if (display->leased_crtcs_count == ARRAY_SIZE(display->leased_crtc_ids))
+		return -ENOSPC;
+
+	memset(lease, 0, sizeof(*lease));
+	lease->fd = -1;
+
+	lease->objects[lease->objects_count++] = display->output.connector_id;
+	lease->objects[lease->objects_count++] = display->output.crtc_id;
+
+	/* With universal planes, planes have to be leased explicitly. */
+	for (i = 0; i < ARRAY_SIZE(plane_setups); i++)
+		if (plane_setups[i]->plane.id)
+			lease->objects[lease->objects_count++] =
+				plane_setups[i]->plane.id;
+
+	fd = drmModeCreateLease(display->drm_fd, lease->objects,
+				lease->objects_count, O_CLOEXEC | O_NONBLOCK,
+				&lease->lessee_id);
+	if (fd < 0)
+		return fd;
+
+	lease->fd = fd;
+
+	display->leased_crtc_ids[display->leased_crtcs_count++] =
+		display->output.crtc_id;
+
+	return 0;
+}
+
+int drm_display_lease_revoke(struct drm_display *display,
+			     struct drm_display_lease *lease)
+{
+	unsigned int i;
+	int ret;
+
+	if (!display || !lease || !lease->lessee_id)
+		return -EINVAL;
+
+	ret = drmModeRevokeLease(display->drm_fd, lease->lessee_id);
+	if (ret)
+		return -errno;
+
+	/* The CRTC is the second leased object. */
+	for (i = 0; i < display->leased_crtcs_count; i++) {
+		if (display->leased_crtc_ids[i] != lease->objects[1])
+			continue;
+
+		display->leased_crtc_ids[i] =
+			display->leased_crtc_ids[--display->leased_crtcs_count];
+		break;
+	}
+
+	if (lease->fd >= 0)
+		close(lease->fd);
+
+	lease->fd = -1;
+	lease->lessee_id = 0;
+
+	return 0;
+}
+
+int drm_display_lease_send(struct drm_display_lease *lease, int socket_fd)
+{
+	char control[CMSG_SPACE(sizeof(int))] = { 0 };
+	struct msghdr message = { 0 };
+	struct cmsghdr *header;
+	struct iovec iovec;
+	ssize_t count;
+
+	if (!lease || lease->fd < 0)
+		return -EINVAL;
+
+	/* At least one byte of data has to carry the descriptor. */
+	iovec.iov_base = &lease->lessee_id;
+	iovec.iov_len = sizeof(lease->lessee_id);
+
+	message.msg_iov = &iovec;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+
+	header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(header), &lease->fd, sizeof(int));
+
+	count = sendmsg(socket_fd, &message, MSG_NOSIGNAL);
+	if (count < 0)
+		return -errno;
+
+	/* The lessee owns the lease now, revoking only needs its ID. */
+	close(lease->fd);
+	lease->fd = -1;
+
+	return 0;
+}
+
+int drm_display_lease_receive(int socket_fd, int *fd)
+{
+	char control[CMSG_SPACE(sizeof(int))] = { 0 };
+	struct msghdr message = { 0 };
+	struct cmsghdr *header;
+	struct iovec iovec;
+	uint32_t lessee_id;
+	ssize_t count;
+
+	if (!fd)
+		return -EINVAL;
+
+	iovec.iov_base = &lessee_id;
+	iovec.iov_len = sizeof(lessee_id);
+
+	message.msg_iov = &iovec;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+
+	count = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC);
+	if (count < 0)
+		return -errno;
+	else if (count == 0)
+		return -EPIPE;
+
+	header = CMSG_FIRSTHDR(&message);
+	if (!header || header->cmsg_level != SOL_SOCKET ||
+	    header->cmsg_type != SCM_RIGHTS ||
+	    header->cmsg_len != CMSG_LEN(sizeof(int)))
+		return -EBADMSG;
+
+	memcpy(fd, CMSG_DATA(header), sizeof(int));
+
+	return 0;
+}
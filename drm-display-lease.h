@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2026 Paul Kocialkowski <contact@paulk.fr>
+ */
+
+#ifndef _DRM_DISPLAY_LEASE_H_
+#define _DRM_DISPLAY_LEASE_H_
+
+#include <stdint.h>
+
+#include <drm-display.h>
+
+/*
+ * A lease hands the output of a probed display over to another DRM master:
+ * its connector, CRTC and planes. The lessor must no longer commit to these
+ * objects until the lease is revoked.
+ */
+struct drm_display_lease {
+	uint32_t objects[5];
+	unsigned int objects_count;
+
+	uint32_t lessee_id;
+	int fd;
+};
+
+int drm_display_lease_create(struct drm_display *display,
+			     struct drm_display_lease *lease);
+int drm_display_lease_revoke(struct drm_display *display,
+			     struct drm_display_lease *lease);
+int drm_display_lease_send(struct drm_display_lease *lease, int socket_fd);
+int drm_display_lease_receive(int socket_fd, int *fd);
+
+#endif
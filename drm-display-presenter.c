@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2026 Paul Kocialkowski <contact@paulk.fr>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <sys/eventfd.h>
+#include <pthread.h>
+
+#include <drm-display.h>
+#include <drm-display-presenter.h>
+
+int drm_display_queue_push(struct drm_display_queue *queue,
+			   struct drm_display_buffer *buffer)
+{
+	unsigned int head, tail;
+
+	if (!queue || !buffer)
+		return -EINVAL;
+
+	tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+	if ((tail - head) == DRM_DISPLAY_QUEUE_SIZE)
+		return -EAGAIN;
+
+	queue->buffers[tail % DRM_DISPLAY_QUEUE_SIZE] = buffer;
+
+	atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+
+	return 0;
+}
+
+struct drm_display_buffer *drm_display_queue_pop(struct drm_display_queue *queue)
+{
+	struct drm_display_buffer *buffer;
+	unsigned int head, tail;
+
+	if (!queue)
+		return NULL;
+
+	head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+	if (head == tail)
+		return NULL;
+
+	buffer = queue->buffers[head % DRM_DISPLAY_QUEUE_SIZE];
+
+	atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+
+	return buffer;
+}
+
+static void queue_init(struct drm_display_queue *queue)
+{
+	memset(queue->buffers, 0, sizeof(queue->buffers));
+
+	atomic_init(&queue->head, 0);
+	atomic_init(&queue->tail, 0);
+}
+
+static int presenter_wake(struct drm_display_presenter *presenter)
+{
+	uint64_t count = 1;
+	ssize_t length;
+
+	/* This never blocks, a saturated counter already means a wakeup. */
+	length = write(presenter->event_fd, &count, sizeof(count));
+	if (length < 0 && errno != EAGAIN)
+		return -errno;
+
+	return 0;
+}
+
+struct drm_display_buffer *drm_display_presenter_buffer_acquire(struct drm_display_presenter *presenter)
+{
+	if (!presenter)
+		return NULL;
+
+	return drm_display_queue_pop(&presenter->release_queue);
+}
+
+int drm_display_presenter_buffer_present(struct drm_display_presenter *presenter,
+					 struct drm_display_buffer *buffer)
+{
+	int ret;
+
+	if (!presenter || !buffer || !presenter->started)
+		return -EINVAL;
+
+	ret = drm_display_queue_push(&presenter->present_queue, buffer);
+	if (ret)
+		return ret;
+
+	return presenter_wake(presenter);
+}
+
+static int presenter_commit(struct drm_display_presenter *presenter,
+			    struct drm_display_buffer *buffer)
+{
+	struct drm_display *display = presenter->display;
+	struct drm_display_plane_setup *plane_setup = presenter->plane_setup;
+	struct drm_display_buffer *buffer_previous;
+	int ret;
+
+	buffer_previous = plane_setup->buffer_visible;
+
+	if (!plane_setup->configured)
+		ret = drm_display_configure(display, plane_setup, buffer);
+	else
+		ret = drm_display_page_flip(display, plane_setup, buffer);
+
+	/* Hand back whichever buffer is no longer scanned out. */
+	if (ret) {
+		drm_display_queue_push(&presenter->release_queue, buffer);
+		atomic_fetch_add(&presenter->dropped, 1);
+	} else if (plane_setup->buffer_visible != buffer) {
+		/* The flip was skipped since nothing changed. */
+		drm_display_queue_push(&presenter->release_queue, buffer);
+	} else {
+		if (buffer_previous && buffer_previous != buffer)
+			drm_display_queue_push(&presenter->release_queue,
+					       buffer_previous);
+
+		atomic_fetch_add(&presenter->presented, 1);
+	}
+
+	return ret;
+}
+
+static struct drm_display_buffer *presenter_mailbox_pop(struct drm_display_presenter *presenter)
+{
+	struct drm_display_buffer *buffer_newest = NULL;
+	struct drm_display_buffer *buffer;
+
+	/* Stale frames go straight back to the producer. */
+	while ((buffer = drm_display_queue_pop(&presenter->present_queue))) {
+		if (buffer_newest) {
+			drm_display_queue_push(&presenter->release_queue,
+					       buffer_newest);
+			atomic_fetch_add(&presenter->superseded, 1);
+		}
+
+		buffer_newest = buffer;
+	}
+
+	return buffer_newest;
+}
+
+static void *presenter_thread(void *data)
+{
+	struct drm_display_presenter *presenter = data;
+	struct drm_display_buffer *buffer;
+	uint64_t count;
+	ssize_t length;
+
+	while (atomic_load(&presenter->running)) {
+		length = read(presenter->event_fd, &count, sizeof(count));
+		if (length < 0 && errno != EINTR)
+			break;
+
+		if (presenter->mode == DRM_DISPLAY_PRESENTER_MAILBOX) {
+			/* More frames may complete during the commit. */
+			while ((buffer = presenter_mailbox_pop(presenter)))
+				presenter_commit(presenter, buffer);
+		} else {
+			while ((buffer = drm_display_queue_pop(&presenter->present_queue)))
+				presenter_commit(presenter, buffer);
+		}
+	}
+
+	return NULL;
+}
+
+void drm_display_presenter_stats(struct drm_display_presenter *presenter,
+				  struct drm_display_presenter_stats *stats)
+{
+	if (!presenter || !stats)
+		return;
+
+	stats->presented = atomic_load(&presenter->presented);
+	stats->superseded = atomic_load(&presenter->superseded);
+	stats->dropped = atomic_load(&presenter->dropped);
+}
+
+int drm_display_presenter_start(struct drm_display_presenter *presenter,
+				struct drm_display *display,
+				struct drm_display_plane_setup *plane_setup,
+				struct drm_display_buffer *buffers,
+				unsigned int buffers_count)
+{
+	unsigned int i;
+	int ret;
+
+	if (!presenter || !display || !plane_setup || !buffers)
+		return -EINVAL;
+
+	if (buffers_count > DRM_DISPLAY_QUEUE_SIZE)
+		return -EINVAL;
+
+	if (presenter->started)
+		return -EBUSY;
+
+	presenter->display = display;
+	presenter->plane_setup = plane_setup;
+
+	queue_init(&presenter->present_queue);
+	queue_init(&presenter->release_queue);
+
+	/* Every buffer that is not scanned out starts free. */
+	for (i = 0; i < buffers_count; i++)
+		if (&buffers[i] != plane_setup->buffer_visible)
+			drm_display_queue_push(&presenter->release_queue,
+					       &buffers[i]);
+
+	presenter->event_fd = eventfd(0, EFD_CLOEXEC);
+	if (presenter->event_fd < 0)
+		return -errno;
+
+	atomic_init(&presenter->presented, 0);
+	atomic_init(&presenter->superseded, 0);
+	atomic_init(&presenter->dropped, 0);
+	atomic_init(&presenter->running, true);
+
+	ret = pthread_create(&presenter->thread, NULL, presenter_thread,
+			     presenter);
+	if (ret) {
+		close(presenter->event_fd);
+		presenter->event_fd = -1;
+		return -ret;
+	}
+
+	presenter->started = true;
+
+	return 0;
+}
+
+void drm_display_presenter_stop(struct drm_display_presenter *presenter)
+{
+	int ret;
+
+	if (!presenter || !presenter->started)
+		return;
+
+	atomic_store(&presenter->running, false);
+
+	/* Without a wakeup, the thread can only be stopped at its read. */
+	ret = presenter_wake(presenter);
+	if (ret)
+		pthread_cancel(presenter->thread);
+
+	pthread_join(presenter->thread, NULL);
+
+	close(presenter->event_fd);
+	presenter->event_fd = -1;
+	presenter->started = false;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2026 Paul Kocialkowski <contact@paulk.fr>
+ */
+
+#ifndef _DRM_DISPLAY_PRESENTER_H_
+#define _DRM_DISPLAY_PRESENTER_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <drm-display.h>
+
+#define DRM_DISPLAY_QUEUE_SIZE	8
+
+/* Single-producer single-consumer ring of buffers. */
+struct drm_display_queue {
+	struct drm_display_buffer *buffers[DRM_DISPLAY_QUEUE_SIZE];
+
+	atomic_uint head;
+	atomic_uint tail;
+};
+
+enum drm_display_presenter_mode {
+	/* Every presented buffer is shown, in order. */
+	DRM_DISPLAY_PRESENTER_FIFO = 0,
+	/* Only the newest presented buffer is shown at each commit. */
+	DRM_DISPLAY_PRESENTER_MAILBOX,
+};
+
+struct drm_display_presenter_stats {
+	unsigned int presented;
+	unsigned int superseded;
+	unsigned int dropped;
+};
+
+/*
+ * The presenter thread owns the DRM device while running: a single producer
+ * thread presents completed buffers and acquires released ones, without
+ * calling into the display directly.
+ */
+struct drm_display_presenter {
+	struct drm_display *display;
+	struct drm_display_plane_setup *plane_setup;
+	enum drm_display_presenter_mode mode;
+
+	struct drm_display_queue present_queue;
+	struct drm_display_queue release_queue;
+
+	pthread_t thread;
+	int event_fd;
+	bool started;
+	atomic_bool running;
+
+	atomic_uint presented;
+	atomic_uint superseded;
+	atomic_uint dropped;
+};
+
+int drm_display_queue_push(struct drm_display_queue *queue,
+			   struct drm_display_buffer *buffer);
+struct drm_display_buffer *drm_display_queue_pop(struct drm_display_queue *queue);
+struct drm_display_buffer *drm_display_presenter_buffer_acquire(struct drm_display_presenter *presenter);
+int drm_display_presenter_buffer_present(struct drm_display_presenter *presenter,
+					 struct drm_display_buffer *buffer);
+void drm_display_presenter_stats(struct drm_display_presenter *presenter,
+				  struct drm_display_presenter_stats *stats);
+int drm_display_presenter_start(struct drm_display_presenter *presenter,
+				struct drm_display *display,
+				struct drm_display_plane_setup *plane_setup,
+				struct drm_display_buffer *buffers,
+				unsigned int buffers_count);
+void drm_display_presenter_stop(struct drm_display_presenter *presenter);
+
+#endif
@@ -0,0 +1,957 @@
+/*
+ * Copyright (C) 2026 Paul Kocialkowski <contact@paulk.fr>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <xf86drmMode.h>
+#include <xf86drm.h>
+
+#include <drm-display.h>
+#include <drm-display-recorder.h>
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+#define DIV_ROUND_UP(value, divider) (((value) + (divider) - 1) / (divider))
+#define ALIGN(value, alignment) (DIV_ROUND_UP(value, alignment) * (alignment))
+
+#define RECORDER_CAPACITY_DEFAULT	(1024 * 1024)
+#define RECORDER_PROPERTIES_MAX		64
+#define RECORDER_BUFFERS_MAX		8
+#define REPLAY_BUFFERS_MAX		32
+
+enum recorder_name {
+	RECORDER_FB_ID = 0,
+	RECORDER_CRTC_ID,
+	RECORDER_SRC_X,
+	RECORDER_SRC_Y,
+	RECORDER_SRC_W,
+	RECORDER_SRC_H,
+	RECORDER_CRTC_X,
+	RECORDER_CRTC_Y,
+	RECORDER_CRTC_W,
+	RECORDER_CRTC_H,
+	RECORDER_ZPOS,
+	RECORDER_ALPHA,
+	RECORDER_PIXEL_BLEND_MODE,
+	RECORDER_ROTATION,
+	RECORDER_ACTIVE,
+	RECORDER_MODE_ID,
+	RECORDER_GAMMA_LUT,
+	RECORDER_DEGAMMA_LUT,
+	RECORDER_CTM,
+	RECORDER_WRITEBACK_FB_ID,
+	RECORDER_WRITEBACK_OUT_FENCE_PTR,
+	RECORDER_NAMES_COUNT,
+};
+
+/* Properties set by the library, indexed by their recorded name. */
+static const char *recorder_names[] = {
+	[RECORDER_FB_ID]			= "FB_ID",
+	[RECORDER_CRTC_ID]			= "CRTC_ID",
+	[RECORDER_SRC_X]			= "SRC_X",
+	[RECORDER_SRC_Y]			= "SRC_Y",
+	[RECORDER_SRC_W]			= "SRC_W",
+	[RECORDER_SRC_H]			= "SRC_H",
+	[RECORDER_CRTC_X]			= "CRTC_X",
+	[RECORDER_CRTC_Y]			= "CRTC_Y",
+	[RECORDER_CRTC_W]			= "CRTC_W",
+	[RECORDER_CRTC_H]			= "CRTC_H",
+	[RECORDER_ZPOS]				= "zpos",
+	[RECORDER_ALPHA]			= "alpha",
+	[RECORDER_PIXEL_BLEND_MODE]		= "pixel blend mode",
+	[RECORDER_ROTATION]			= "rotation",
+	[RECORDER_ACTIVE]			= "ACTIVE",
+	[RECORDER_MODE_ID]			= "MODE_ID",
+	[RECORDER_GAMMA_LUT]			= "GAMMA_LUT",
+	[RECORDER_DEGAMMA_LUT]			= "DEGAMMA_LUT",
+	[RECORDER_CTM]				= "CTM",
+	[RECORDER_WRITEBACK_FB_ID]		= "WRITEBACK_FB_ID",
+	[RECORDER_WRITEBACK_OUT_FENCE_PTR]	= "WRITEBACK_OUT_FENCE_PTR",
+};
+
+static uint64_t recorder_time_us(void)
+{
+	struct timespec timespec = { 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &timespec);
+
+	return (uint64_t)timespec.tv_sec * 1000000 + timespec.tv_nsec / 1000;
+}
+
+static void recorder_objects(struct drm_display *display,
+			     uint32_t ids[DRM_DISPLAY_RECORDER_ROLES_COUNT],
+			     uint32_t types[DRM_DISPLAY_RECORDER_ROLES_COUNT])
+{
+	unsigned int i;
+
+	ids[DRM_DISPLAY_RECORDER_CONNECTOR] = display->output.connector_id;
+	ids[DRM_DISPLAY_RECORDER_CRTC] = display->output.crtc_id;
+	ids[DRM_DISPLAY_RECORDER_PRIMARY] = display->primary_setup.plane.id;
+	ids[DRM_DISPLAY_RECORDER_OVERLAY] = display->overlay_setup.plane.id;
+	ids[DRM_DISPLAY_RECORDER_CURSOR] = display->cursor_setup.plane.id;
+	ids[DRM_DISPLAY_RECORDER_WRITEBACK] = display->writeback.connector_id;
+
+	for (i = 0; i < DRM_DISPLAY_RECORDER_ROLES_COUNT; i++)
+		types[i] = DRM_MODE_OBJECT_PLANE;
+
+	types[DRM_DISPLAY_RECORDER_CONNECTOR] = DRM_MODE_OBJECT_CONNECTOR;
+	types[DRM_DISPLAY_RECORDER_CRTC] = DRM_MODE_OBJECT_CRTC;
+	types[DRM_DISPLAY_RECORDER_WRITEBACK] = DRM_MODE_OBJECT_CONNECTOR;
+}
+
+static int recorder_name_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < RECORDER_NAMES_COUNT; i++)
+		if (!strcmp(recorder_names[i], name))
+			return i;
+
+	return -1;
+}
+
+/* Resolve the name index of each property of an object, by property ID. */
+static int object_properties_names(int drm_fd, uint32_t object_id,
+				   uint32_t type,
+				   void (*callback)(uint32_t property_id,
+						    int name, void *data),
+				   void *data)
+{
+	drmModeObjectPropertiesPtr properties;
+	unsigned int i;
+
+	properties = drmModeObjectGetProperties(drm_fd, object_id, type);
+	if (!properties)
+		return -errno;
+
+	for (i = 0; i < properties->count_props; i++) {
+		drmModePropertyPtr property;
+		int name;
+
+		property = drmModeGetProperty(drm_fd, properties->props[i]);
+		if (!property)
+			continue;
+
+		name = recorder_name_find(property->name);
+		if (name >= 0)
+			callback(property->prop_id, name, data);
+
+		drmModeFreeProperty(property);
+	}
+
+	drmModeFreeObjectProperties(properties);
+
+	return 0;
+}
+
+struct recorder_maps_probe {
+	struct drm_display_recorder *recorder;
+	uint32_t object_id;
+	uint8_t role;
+};
+
+static void recorder_map_add(uint32_t property_id, int name, void *data)
+{
+	struct recorder_maps_probe *probe = data;
+	struct drm_display_recorder *recorder = probe->recorder;
+	struct drm_display_recorder_map *map;
+
+	if (recorder->maps_count == ARRAY_SIZE(recorder->maps))
+		return;
+
+	map = &recorder->maps[recorder->maps_count++];
+	map->object_id = probe->object_id;
+	map->property_id = property_id;
+	map->role = probe->role;
+	map->name = name;
+}
+
+static const struct drm_display_recorder_map *recorder_map_find(struct drm_display_recorder *recorder,
+								uint32_t object_id,
+								uint32_t property_id)
+{
+	unsigned int i;
+
+	for (i = 0; i < recorder->maps_count; i++)
+		if (recorder->maps[i].object_id == object_id &&
+		    recorder->maps[i].property_id == property_id)
+			return &recorder->maps[i];
+
+	return NULL;
+}
+
+/* Offset of the record at offset, skipping the unused end of the ring. */
+static uint32_t recorder_ring_next(const struct drm_display_recorder_header *header,
+				   const uint8_t *ring, uint32_t offset)
+{
+	const struct drm_display_recorder_record *record;
+
+	if (header->capacity - offset < sizeof(*record))
+		return 0;
+
+	record = (const void *)(ring + offset);
+	if (record->type == DRM_DISPLAY_RECORDER_PADDING)
+		return 0;
+
+	return offset;
+}
+
+static void recorder_ring_evict(struct drm_display_recorder *recorder,
+				uint32_t offset, uint32_t size)
+{
+	struct drm_display_recorder_header *header = recorder->header;
+	struct drm_display_recorder_record *record;
+	uint32_t tail;
+
+	while (header->records_count) {
+		tail = recorder_ring_next(header, recorder->ring, header->tail);
+		header->tail = tail;
+
+		if (tail < offset || tail >= offset + size)
+			break;
+
+		record = (void *)(recorder->ring + tail);
+
+		header->tail = tail + record->size;
+		header->records_count--;
+		header->records_dropped++;
+	}
+}
+
+static void recorder_ring_write(struct drm_display_recorder *recorder,
+				const void *data, uint32_t size)
+{
+	struct drm_display_recorder_header *header = recorder->header;
+	uint32_t remaining = header->capacity - header->head;
+
+	if (size > header->capacity / 2) {
+		header->records_dropped++;
+		return;
+	}
+
+	if (remaining < size) {
+		recorder_ring_evict(recorder, header->head, remaining);
+
+		if (remaining >= sizeof(struct drm_display_recorder_record)) {
+			struct drm_display_recorder_record padding = { 0 };
+
+			padding.size = remaining;
+			padding.type = DRM_DISPLAY_RECORDER_PADDING;
+
+			memcpy(recorder->ring + header->head, &padding,
+			       sizeof(padding));
+		}
+
+		header->head = 0;
+	}
+
+	recorder_ring_evict(recorder, header->head, size);
+
+	if (!header->records_count)
+		header->tail = header->head;
+
+	memcpy(recorder->ring + header->head, data, size);
+
+	/* Only account for the record once it is fully written. */
+	header->head += size;
+	header->records_count++;
+}
+
+static void recorder_commit_hook(struct drm_display *display,
+				 const struct drm_display_commit *commit,
+				 void *private)
+{
+	struct drm_display_recorder *recorder = private;
+	uint8_t data[sizeof(struct drm_display_recorder_record) +
+		     RECORDER_PROPERTIES_MAX *
+		     sizeof(struct drm_display_recorder_property) +
+		     RECORDER_BUFFERS_MAX *
+		     sizeof(struct drm_display_recorder_buffer) + 8] = { 0 };
+	struct drm_display_recorder_property properties[RECORDER_PROPERTIES_MAX];
+	struct drm_display_recorder_buffer buffers[RECORDER_BUFFERS_MAX];
+	struct drm_display_recorder_record record = { 0 };
+	unsigned int properties_count = 0;
+	unsigned int buffers_count = 0;
+	unsigned int offset;
+	bool truncated = commit->truncated;
+	unsigned int i, j;
+
+	for (i = 0; i < commit->items_count; i++) {
+		const struct drm_display_commit_item *item = &commit->items[i];
+		const struct drm_display_recorder_map *map;
+
+		if (properties_count == RECORDER_PROPERTIES_MAX) {
+			truncated = true;
+			break;
+		}
+
+		map = recorder_map_find(recorder, item->object_id,
+					item->property_id);
+		if (!map)
+			continue;
+
+		properties[properties_count].role = map->role;
+		properties[properties_count].name = map->name;
+		properties[properties_count].reserved = 0;
+		properties[properties_count].value_low = item->value;
+		properties[properties_count].value_high = item->value >> 32;
+		properties_count++;
+	}
+
+	/* Identities come with the commit, as FB IDs are reused once removed. */
+	for (i = 0; i < commit->buffers_count; i++) {
+		const struct drm_display_commit_buffer *identity =
+			&commit->buffers[i];
+
+		if (buffers_count == RECORDER_BUFFERS_MAX) {
+			truncated = true;
+			break;
+		}
+
+		for (j = 0; j < buffers_count; j++)
+			if (buffers[j].fb_id == identity->fb_id)
+				break;
+
+		if (j < buffers_count)
+			continue;
+
+		buffers[buffers_count].fb_id = identity->fb_id;
+		buffers[buffers_count].width = identity->width;
+		buffers[buffers_count].height = identity->height;
+		buffers[buffers_count].format = identity->format;
+		buffers_count++;
+	}
+
+	record.type = DRM_DISPLAY_RECORDER_COMMIT;
+	record.time_us = commit->time_us;
+	record.duration_us = commit->duration_us;
+	record.flags = commit->flags;
+	record.result = commit->result;
+
+	if (truncated)
+		record.flags |= DRM_DISPLAY_RECORDER_TRUNCATED;
+	record.properties_count = properties_count;
+	record.buffers_count = buffers_count;
+
+	offset = sizeof(record);
+	memcpy(data + offset, properties,
+	       properties_count * sizeof(*properties));
+	offset += properties_count * sizeof(*properties);
+	memcpy(data + offset, buffers, buffers_count * sizeof(*buffers));
+	offset += buffers_count * sizeof(*buffers);
+
+	record.size = ALIGN(offset, 8);
+	memcpy(data, &record, sizeof(record));
+
+	pthread_mutex_lock(&recorder->lock);
+	recorder_ring_write(recorder, data, record.size);
+	pthread_mutex_unlock(&recorder->lock);
+}
+
+int drm_display_recorder_start(struct drm_display_recorder *recorder,
+			       struct drm_display *display, const char *path,
+			       unsigned int capacity)
+{
+	uint32_t ids[DRM_DISPLAY_RECORDER_ROLES_COUNT];
+	uint32_t types[DRM_DISPLAY_RECORDER_ROLES_COUNT];
+	struct drm_display_recorder_header *header;
+	struct recorder_maps_probe probe;
+	unsigned int i;
+	void *map;
+	int ret;
+
+	if (!recorder || !display || !path || display->commit_hook)
+		return -EINVAL;
+
+	memset(recorder, 0, sizeof(*recorder));
+	recorder->display = display;
+	recorder->fd = -1;
+
+	if (!capacity)
+		capacity = RECORDER_CAPACITY_DEFAULT;
+
+	capacity = ALIGN(capacity, 8);
+
+	/* Properties are recorded by role and name, not by local ID. */
+	recorder_objects(display, ids, types);
+
+	for (i = 0; i < DRM_DISPLAY_RECORDER_ROLES_COUNT; i++) {
+		if (!ids[i])
+			continue;
+
+		probe.recorder = recorder;
+		probe.object_id = ids[i];
+		probe.role = i;
+
+		ret = object_properties_names(display->drm_fd, ids[i],
+					      types[i], recorder_map_add,
+					      &probe);
+		if (ret)
+			return ret;
+	}
+
+	recorder->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+			    0644);
+	if (recorder->fd < 0)
+		return -errno;
+
+	recorder->map_size = sizeof(*header) + capacity;
+
+	ret = ftruncate(recorder->fd, recorder->map_size);
+	if (ret) {
+		ret = -errno;
+		goto error;
+	}
+
+	map = mmap(NULL, recorder->map_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, recorder->fd, 0);
+	if (map == MAP_FAILED) {
+		ret = -errno;
+		goto error;
+	}
+
+	recorder->map = map;
+	recorder->header = map;
+	recorder->ring = (uint8_t *)map + sizeof(*header);
+
+	header = recorder->header;
+	memcpy(header->magic, DRM_DISPLAY_RECORDER_MAGIC,
+	       sizeof(header->magic));
+	header->version = DRM_DISPLAY_RECORDER_VERSION;
+	header->capacity = capacity;
+	header->names_count = RECORDER_NAMES_COUNT;
+
+	for (i = 0; i < RECORDER_NAMES_COUNT; i++)
+		strncpy(header->names[i], recorder_names[i],
+			DRM_DISPLAY_RECORDER_NAME_SIZE - 1);
+
+	pthread_mutex_init(&recorder->lock, NULL);
+
+	display->commit_hook_private = recorder;
+	display->commit_hook = recorder_commit_hook;
+
+	return 0;
+
+error:
+	close(recorder->fd);
+	recorder->fd = -1;
+
+	return ret;
+}
+
+void drm_display_recorder_stop(struct drm_display_recorder *recorder)
+{
+	if (!recorder || !recorder->map)
+		return;
+
+	if (recorder->display->commit_hook == recorder_commit_hook) {
+		recorder->display->commit_hook = NULL;
+		recorder->display->commit_hook_private = NULL;
+	}
+
+	msync(recorder->map, recorder->map_size, MS_SYNC);
+	munmap(recorder->map, recorder->map_size);
+	recorder->map = NULL;
+
+	close(recorder->fd);
+	recorder->fd = -1;
+
+	pthread_mutex_destroy(&recorder->lock);
+}
+
+struct replay {
+	struct drm_display *display;
+	const struct drm_display_recorder_header *header;
+	const uint8_t *ring;
+
+	/* Local object and property IDs, by role and by name in the log. */
+	uint32_t ids[DRM_DISPLAY_RECORDER_ROLES_COUNT];
+	uint32_t properties[DRM_DISPLAY_RECORDER_ROLES_COUNT][DRM_DISPLAY_RECORDER_NAMES_MAX];
+
+	/* Our name for each name in the log, which may list them otherwise. */
+	int names[DRM_DISPLAY_RECORDER_NAMES_MAX];
+
+	struct replay_buffer *buffers;
+	uint32_t mode_blob_id;
+
+	struct drm_display_replay_stats *stats;
+};
+
+struct replay_properties_probe {
+	struct replay *replay;
+	uint8_t role;
+};
+
+static void replay_property_map(uint32_t property_id, int name, void *data)
+{
+	struct replay_properties_probe *probe = data;
+	struct replay *replay = probe->replay;
+	unsigned int i;
+
+	for (i = 0; i < replay->header->names_count; i++)
+		if (replay->names[i] == name)
+			replay->properties[probe->role][i] = property_id;
+}
+
+struct replay_buffer {
+	uint32_t fb_id;
+	struct drm_display_buffer buffer;
+};
+
+static struct drm_display_buffer *replay_buffer_find(struct replay *replay,
+						     const struct drm_display_recorder_buffer *identity)
+{
+	struct drm_display_plane_setup plane_setup = { 0 };
+	struct replay_buffer *buffers = replay->buffers;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < REPLAY_BUFFERS_MAX; i++) {
+		if (buffers[i].fb_id == identity->fb_id)
+			return &buffers[i].buffer;
+
+		if (!buffers[i].fb_id)
+			break;
+	}
+
+	if (i == REPLAY_BUFFERS_MAX)
+		return NULL;
+
+	/* Local stand-ins keep the layout of the recorded buffers. */
+	plane_setup.buffer_width = identity->width;
+	plane_setup.buffer_height = identity->height;
+	plane_setup.buffer_format = identity->format;
+
+	ret = drm_display_buffer_setup(replay->display, &buffers[i].buffer,
+				       &plane_setup);
+	if (ret)
+		return NULL;
+
+	drm_display_buffer_fill(&buffers[i].buffer, NULL,
+				0x00204080 * (i + 1));
+
+	buffers[i].fb_id = identity->fb_id;
+
+	return &buffers[i].buffer;
+}
+
+static const struct drm_display_recorder_buffer *replay_record_buffer(const struct drm_display_recorder_record *record,
+								       uint32_t fb_id)
+{
+	const struct drm_display_recorder_buffer *buffers;
+	unsigned int i;
+
+	buffers = (const void *)((const uint8_t *)(record + 1) +
+				 record->properties_count *
+				 sizeof(struct drm_display_recorder_property));
+
+	for (i = 0; i < record->buffers_count; i++)
+		if (buffers[i].fb_id == fb_id)
+			return &buffers[i];
+
+	return NULL;
+}
+
+/* Records come from a file, nothing in them can be trusted. */
+static const struct drm_display_recorder_record *replay_record_next(struct replay *replay,
+								     uint32_t *offset)
+{
+	const struct drm_display_recorder_header *header = replay->header;
+	const struct drm_display_recorder_record *record;
+	size_t size;
+
+	*offset = recorder_ring_next(header, replay->ring, *offset);
+	record = (const void *)(replay->ring + *offset);
+
+	if (record->size < sizeof(*record) ||
+	    record->size > header->capacity - *offset)
+		return NULL;
+
+	size = sizeof(*record) +
+	       record->properties_count *
+	       sizeof(struct drm_display_recorder_property) +
+	       record->buffers_count *
+	       sizeof(struct drm_display_recorder_buffer);
+	if (size > record->size)
+		return NULL;
+
+	*offset += record->size;
+
+	return record;
+}
+
+/* Substitute local objects for recorded ones, false to skip the property. */
+static bool replay_property_value(struct replay *replay,
+				  const struct drm_display_recorder_record *record,
+				  const struct drm_display_recorder_property *property,
+				  uint32_t *property_id, uint64_t *value)
+{
+	const struct drm_display_recorder_buffer *identity;
+	struct drm_display_buffer *buffer;
+
+	if (property->role >= DRM_DISPLAY_RECORDER_ROLES_COUNT ||
+	    property->name >= replay->header->names_count)
+		return false;
+
+	*property_id = replay->properties[property->role][property->name];
+	if (!*property_id)
+		return false;
+
+	*value = (uint64_t)property->value_high << 32 | property->value_low;
+
+	switch (replay->names[property->name]) {
+	case RECORDER_FB_ID:
+		if (!*value)
+			break;
+
+		identity = replay_record_buffer(record, *value);
+		buffer = identity ? replay_buffer_find(replay, identity) : NULL;
+		*value = buffer ? buffer->fb_id : 0;
+		break;
+	case RECORDER_CRTC_ID:
+		if (*value)
+			*value = replay->display->output.crtc_id;
+		break;
+	case RECORDER_MODE_ID:
+		if (*value)
+			*value = replay->mode_blob_id;
+		break;
+	case RECORDER_GAMMA_LUT:
+	case RECORDER_DEGAMMA_LUT:
+	case RECORDER_CTM:
+		/* Blob contents are not part of the log. */
+		return false;
+	default:
+		break;
+	}
+
+	return true;
+}
+
+/*
+ * Once the ring wrapped, the commits that lit up the output are gone.
+ * Start from a modeset with the first value logged for each property.
+ */
+static int replay_state_restore(struct replay *replay)
+{
+	const struct drm_display_recorder_header *header = replay->header;
+	const struct drm_display_recorder_record *record;
+	const struct drm_display_recorder_property *properties;
+	struct drm_display *display = replay->display;
+	bool set[DRM_DISPLAY_RECORDER_ROLES_COUNT][DRM_DISPLAY_RECORDER_NAMES_MAX] = { 0 };
+	uint32_t *crtc_properties =
+		replay->properties[DRM_DISPLAY_RECORDER_CRTC];
+	uint32_t *connector_properties =
+		replay->properties[DRM_DISPLAY_RECORDER_CONNECTOR];
+	uint32_t connector_id = replay->ids[DRM_DISPLAY_RECORDER_CONNECTOR];
+	uint32_t crtc_id = display->output.crtc_id;
+	drmModeAtomicReqPtr request;
+	uint32_t property_id;
+	uint32_t offset = header->tail;
+	uint64_t value;
+	unsigned int i, j;
+	int ret;
+
+	request = drmModeAtomicAlloc();
+	if (!request)
+		return -ENOMEM;
+
+	for (i = 0; i < header->names_count; i++) {
+		if (replay->names[i] == RECORDER_ACTIVE && crtc_properties[i])
+			drmModeAtomicAddProperty(request, crtc_id,
+						 crtc_properties[i], 1);
+		else if (replay->names[i] == RECORDER_MODE_ID &&
+			 crtc_properties[i])
+			drmModeAtomicAddProperty(request, crtc_id,
+						 crtc_properties[i],
+						 replay->mode_blob_id);
+		else if (replay->names[i] == RECORDER_CRTC_ID &&
+			 connector_properties[i])
+			drmModeAtomicAddProperty(request, connector_id,
+						 connector_properties[i],
+						 crtc_id);
+	}
+
+	for (i = 0; i < header->records_count; i++) {
+		record = replay_record_next(replay, &offset);
+		if (!record) {
+			ret = -EINVAL;
+			goto complete;
+		}
+
+		properties = (const void *)(record + 1);
+
+		/* Only planes, output properties were forced above. */
+		for (j = 0; j < record->properties_count; j++) {
+			uint8_t role = properties[j].role;
+			uint8_t name = properties[j].name;
+
+			if (role < DRM_DISPLAY_RECORDER_PRIMARY ||
+			    role > DRM_DISPLAY_RECORDER_CURSOR ||
+			    name >= header->names_count || set[role][name])
+				continue;
+
+			set[role][name] = true;
+
+			if (replay_property_value(replay, record,
+						  &properties[j], &property_id,
+						  &value))
+				drmModeAtomicAddProperty(request,
+							 replay->ids[role],
+							 property_id, value);
+		}
+	}
+
+	ret = drmModeAtomicCommit(display->drm_fd, request,
+				  DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+	if (ret)
+		ret = -errno;
+
+complete:
+	drmModeAtomicFree(request);
+
+	return ret;
+}
+
+static int replay_header_check(const struct drm_display_recorder_header *header,
+			       size_t size)
+{
+	unsigned int i;
+
+	if (size < sizeof(*header) ||
+	    memcmp(header->magic, DRM_DISPLAY_RECORDER_MAGIC,
+		   sizeof(header->magic)) ||
+	    header->version != DRM_DISPLAY_RECORDER_VERSION)
+		return -EINVAL;
+
+	if (header->capacity > size - sizeof(*header) ||
+	    header->tail >= header->capacity ||
+	    header->records_count >
+	    header->capacity / sizeof(struct drm_display_recorder_record) ||
+	    header->names_count > DRM_DISPLAY_RECORDER_NAMES_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < header->names_count; i++)
+		if (!memchr(header->names[i], '\0', sizeof(header->names[i])))
+			return -EINVAL;
+
+	return 0;
+}
+
+int drm_display_replay(struct drm_display *display, const char *path,
+		       bool realtime, struct drm_display_replay_stats *stats)
+{
+	uint32_t types[DRM_DISPLAY_RECORDER_ROLES_COUNT];
+	const struct drm_display_recorder_record *record;
+	struct replay_properties_probe probe;
+	struct replay replay = { 0 };
+	uint64_t record_start_us = 0;
+	uint64_t start_us;
+	uint32_t offset;
+	struct stat stat_buffer;
+	void *map = MAP_FAILED;
+	unsigned int i, j;
+	int fd;
+	int ret;
+
+	if (!display || !path || !stats)
+		return -EINVAL;
+
+	memset(stats, 0, sizeof(*stats));
+
+	replay.display = display;
+	replay.stats = stats;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	ret = fstat(fd, &stat_buffer);
+	if (ret || stat_buffer.st_size < (off_t)sizeof(*replay.header)) {
+		ret = -EINVAL;
+		goto complete;
+	}
+
+	map = mmap(NULL, stat_buffer.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		ret = -errno;
+		goto complete;
+	}
+
+	replay.header = map;
+	replay.ring = (const uint8_t *)map + sizeof(*replay.header);
+
+	ret = replay_header_check(replay.header, stat_buffer.st_size);
+	if (ret)
+		goto complete;
+
+	for (i = 0; i < replay.header->names_count; i++)
+		replay.names[i] = recorder_name_find(replay.header->names[i]);
+
+	/* Local objects stand in for the recorded ones with the same role. */
+	recorder_objects(display, replay.ids, types);
+
+	for (i = 0; i < DRM_DISPLAY_RECORDER_ROLES_COUNT; i++) {
+		if (!replay.ids[i] || i == DRM_DISPLAY_RECORDER_WRITEBACK)
+			continue;
+
+		probe.replay = &replay;
+		probe.role = i;
+
+		ret = object_properties_names(display->drm_fd, replay.ids[i],
+					      types[i], replay_property_map,
+					      &probe);
+		if (ret)
+			goto complete;
+	}
+
+	ret = drmModeCreatePropertyBlob(display->drm_fd, &display->output.mode,
+					sizeof(display->output.mode),
+					&replay.mode_blob_id);
+	if (ret) {
+		ret = -errno;
+		goto complete;
+	}
+
+	replay.buffers = calloc(REPLAY_BUFFERS_MAX, sizeof(*replay.buffers));
+	if (!replay.buffers) {
+		ret = -ENOMEM;
+		goto complete;
+	}
+
+	stats->records_dropped = replay.header->records_dropped;
+
+	if (stats->records_dropped && replay.header->records_count) {
+		ret = replay_state_restore(&replay);
+		if (ret)
+			goto complete;
+
+		stats->state_restored = true;
+	}
+
+	start_us = recorder_time_us();
+	offset = replay.header->tail;
+
+	for (i = 0; i < replay.header->records_count; i++) {
+		const struct drm_display_recorder_property *properties;
+		drmModeAtomicReqPtr request;
+		uint32_t property_id;
+		uint64_t commit_us;
+		uint64_t value;
+		uint32_t flags;
+
+		record = replay_record_next(&replay, &offset);
+		if (!record) {
+			ret = -EINVAL;
+			goto complete;
+		}
+
+		if (!record_start_us)
+			record_start_us = record->time_us;
+
+		if (realtime) {
+			uint64_t due_us = start_us + record->time_us -
+					  record_start_us;
+			uint64_t now_us = recorder_time_us();
+
+			if (due_us > now_us)
+				usleep(due_us - now_us);
+		}
+
+		request = drmModeAtomicAlloc();
+		if (!request) {
+			ret = -ENOMEM;
+			goto complete;
+		}
+
+		properties = (const void *)(record + 1);
+
+		for (j = 0; j < record->properties_count; j++) {
+			if (!replay_property_value(&replay, record,
+						   &properties[j], &property_id,
+						   &value)) {
+				stats->properties_skipped++;
+				continue;
+			}
+
+			drmModeAtomicAddProperty(request,
+						 replay.ids[properties[j].role],
+						 property_id, value);
+		}
+
+		flags = record->flags & ~DRM_DISPLAY_RECORDER_TRUNCATED;
+		if (record->flags & DRM_DISPLAY_RECORDER_TRUNCATED)
+			stats->commits_truncated++;
+
+		/*
+		 * Back to back commits would find the previous one still in
+		 * flight, so they wait for it instead.
+		 */
+		if (!realtime)
+			flags &= ~DRM_MODE_ATOMIC_NONBLOCK;
+
+		commit_us = recorder_time_us();
+
+		ret = drmModeAtomicCommit(display->drm_fd, request, flags,
+					  NULL);
+
+		commit_us = recorder_time_us() - commit_us;
+
+		drmModeAtomicFree(request);
+
+		stats->commits++;
+
+		if (ret)
+			stats->commits_failed++;
+
+		if (!ret != !record->result)
+			stats->results_mismatched++;
+
+		stats->recorded_us += record->duration_us;
+		if (record->duration_us > stats->recorded_us_max)
+			stats->recorded_us_max = record->duration_us;
+
+		stats->replayed_us += commit_us;
+		if (commit_us > stats->replayed_us_max)
+			stats->replayed_us_max = commit_us;
+	}
+
+	stats->duration_us = recorder_time_us() - start_us;
+
+	ret = 0;
+
+complete:
+	if (replay.buffers) {
+		for (i = 0; i < REPLAY_BUFFERS_MAX; i++) {
+			struct replay_buffer *buffer = &replay.buffers[i];
+
+			if (buffer->fb_id)
+				drm_display_buffer_teardown(display,
+							    &buffer->buffer);
+		}
+
+		free(replay.buffers);
+	}
+
+	if (replay.mode_blob_id)
+		drmModeDestroyPropertyBlob(display->drm_fd,
+					   replay.mode_blob_id);
+
+	if (map != MAP_FAILED)
+		munmap(map, stat_buffer.st_size);
+
+	close(fd);
+
+	return ret;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2026 Paul Kocialkowski <contact@paulk.fr>
+ */
+
+#ifndef _DRM_DISPLAY_RECORDER_H_
+#define _DRM_DISPLAY_RECORDER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <drm-display.h>
+
+#define DRM_DISPLAY_RECORDER_MAGIC	"DRMDREC1"
+#define DRM_DISPLAY_RECORDER_VERSION	1
+#define DRM_DISPLAY_RECORDER_NAMES_MAX	32
+#define DRM_DISPLAY_RECORDER_NAME_SIZE	24
+#define DRM_DISPLAY_RECORDER_NAME_UNKNOWN	0xff
+
+/* Objects are recorded by role, to be found again on another device. */
+enum drm_display_recorder_role {
+	DRM_DISPLAY_RECORDER_CONNECTOR = 0,
+	DRM_DISPLAY_RECORDER_CRTC,
+	DRM_DISPLAY_RECORDER_PRIMARY,
+	DRM_DISPLAY_RECORDER_OVERLAY,
+	DRM_DISPLAY_RECORDER_CURSOR,
+	DRM_DISPLAY_RECORDER_WRITEBACK,
+	DRM_DISPLAY_RECORDER_ROLES_COUNT,
+};
+
+enum drm_display_recorder_record_type {
+	DRM_DISPLAY_RECORDER_COMMIT = 0,
+	/* Fills the end of the ring when the next record does not fit. */
+	DRM_DISPLAY_RECORDER_PADDING,
+};
+
+/*
+ * The log file starts with this header, followed by a ring of records.
+ * Records never wrap: they are 8-byte aligned and the oldest ones are
+ * dropped to make room for new ones. Replaying a log that lost records
+ * starts with a modeset built from the first value of each property.
+ */
+struct drm_display_recorder_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t capacity;
+
+	uint32_t head;
+	uint32_t tail;
+	uint32_t records_count;
+	uint32_t records_dropped;
+
+	uint32_t names_count;
+	uint32_t reserved;
+	char names[DRM_DISPLAY_RECORDER_NAMES_MAX][DRM_DISPLAY_RECORDER_NAME_SIZE];
+};
+
+/* Set in record flags, next to the atomic ones, when properties were lost. */
+#define DRM_DISPLAY_RECORDER_TRUNCATED	(1U << 31)
+
+/* Followed by properties, then by identities of the buffers shown. */
+struct drm_display_recorder_record {
+	uint32_t size;
+	uint32_t type;
+	uint64_t time_us;
+	uint32_t duration_us;
+	uint32_t flags;
+	int32_t result;
+	uint16_t properties_count;
+	uint16_t buffers_count;
+};
+
+struct drm_display_recorder_property {
+	uint8_t role;
+	uint8_t name;
+	uint16_t reserved;
+	uint32_t value_low;
+	uint32_t value_high;
+};
+
+struct drm_display_recorder_buffer {
+	uint32_t fb_id;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+};
+
+struct drm_display_recorder_map {
+	uint32_t object_id;
+	uint32_t property_id;
+	uint8_t role;
+	uint8_t name;
+};
+
+struct drm_display_recorder {
+	struct drm_display *display;
+
+	int fd;
+	void *map;
+	size_t map_size;
+	struct drm_display_recorder_header *header;
+	uint8_t *ring;
+
+	/* Property IDs of the recorded objects, with their role and name. */
+	struct drm_display_recorder_map maps[192];
+	unsigned int maps_count;
+
+	pthread_mutex_t lock;
+};
+
+struct drm_display_replay_stats {
+	/* Records lost to the ring wrapping, including the initial modeset. */
+	unsigned int records_dropped;
+	bool state_restored;
+
+	unsigned int commits;
+	unsigned int commits_failed;
+	unsigned int commits_truncated;
+	unsigned int results_mismatched;
+	unsigned int properties_skipped;
+
+	uint64_t recorded_us;
+	uint64_t recorded_us_max;
+	uint64_t replayed_us;
+	uint64_t replayed_us_max;
+	uint64_t duration_us;
+};
+
+int drm_display_recorder_start(struct drm_display_recorder *recorder,
+			       struct drm_display *display, const char *path,
+			       unsigned int capacity);
+void drm_display_recorder_stop(struct drm_display_recorder *recorder);
+int drm_display_replay(struct drm_display *display, const char *path,
+		       bool realtime, struct drm_display_replay_stats *stats);
+
+#endif
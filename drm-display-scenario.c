@@ -0,0 +1,584 @@
+/*
+ * Copyright (C) 2026 Paul Kocialkowski <contact@paulk.fr>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <drm-display.h>
+#include <drm-display-scenario.h>
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+#define SCENARIO_TOKENS_MAX	16
+
+static const char *scenario_roles[] = {
+	[DRM_DISPLAY_SCENARIO_PRIMARY] = "primary",
+	[DRM_DISPLAY_SCENARIO_OVERLAY] = "overlay",
+	[DRM_DISPLAY_SCENARIO_CURSOR] = "cursor",
+};
+
+static const struct {
+	const char *name;
+	uint32_t format;
+} scenario_formats[] = {
+	{ "XRGB8888",		DRM_FORMAT_XRGB8888 },
+	{ "ARGB8888",		DRM_FORMAT_ARGB8888 },
+	{ "RGB565",		DRM_FORMAT_RGB565 },
+	{ "XRGB2101010",	DRM_FORMAT_XRGB2101010 },
+	{ "NV12",		DRM_FORMAT_NV12 },
+	{ "NV21",		DRM_FORMAT_NV21 },
+	{ "NV16",		DRM_FORMAT_NV16 },
+	{ "YUV420",		DRM_FORMAT_YUV420 },
+	{ "P010",		DRM_FORMAT_P010 },
+};
+
+static uint64_t scenario_time_us(void)
+{
+	struct timespec timespec = { 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &timespec);
+
+	return (uint64_t)timespec.tv_sec * 1000000 + timespec.tv_nsec / 1000;
+}
+
+static int scenario_number(const char *string, unsigned int *value)
+{
+	unsigned long number;
+	char *end;
+
+	errno = 0;
+	number = strtoul(string, &end, 0);
+	if (errno || end == string || *end != '\0' || number > UINT32_MAX)
+		return -EINVAL;
+
+	*value = number;
+
+	return 0;
+}
+
+static int scenario_position(const char *string, int *x, int *y)
+{
+	char end;
+
+	if (sscanf(string, "%d,%d%c", x, y, &end) != 2)
+		return -EINVAL;
+
+	return 0;
+}
+
+static struct drm_display_scenario_plane *scenario_plane(struct drm_display_scenario *scenario,
+							  const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(scenario_roles); i++)
+		if (!strcmp(scenario_roles[i], name))
+			return &scenario->planes[i];
+
+	return NULL;
+}
+
+static int scenario_plane_parse(struct drm_display_scenario_plane *plane,
+				char **tokens, unsigned int count)
+{
+	unsigned int i;
+	int ret;
+
+	if (count < 2)
+		return -EINVAL;
+
+	for (i = 0; i < ARRAY_SIZE(scenario_formats); i++)
+		if (!strcmp(scenario_formats[i].name, tokens[0]))
+			break;
+
+	if (i == ARRAY_SIZE(scenario_formats))
+		return -EINVAL;
+
+	plane->format = scenario_formats[i].format;
+
+	/* Planes sized after the mode get their size at probe time. */
+	if (strcmp(tokens[1], "mode") &&
+	    sscanf(tokens[1], "%ux%u", &plane->width, &plane->height) != 2)
+		return -EINVAL;
+
+	for (i = 2; i + 1 < count; i += 2) {
+		if (!strcmp(tokens[i], "buffers"))
+			ret = scenario_number(tokens[i + 1],
+					      &plane->buffers_count);
+		else if (!strcmp(tokens[i], "rate"))
+			ret = scenario_number(tokens[i + 1], &plane->rate);
+		else if (!strcmp(tokens[i], "at"))
+			ret = scenario_position(tokens[i + 1], &plane->x,
+						&plane->y);
+		else
+			ret = -EINVAL;
+
+		if (ret)
+			return ret;
+	}
+
+	if (i != count || !plane->rate)
+		return -EINVAL;
+
+	plane->used = true;
+
+	return 0;
+}
+
+static int scenario_statement_parse(struct drm_display_scenario *scenario,
+				    char **tokens, unsigned int count)
+{
+	struct drm_display_scenario_plane *plane;
+	unsigned int i;
+	int ret;
+
+	if (!strcmp(tokens[0], "duration") && count == 2)
+		return scenario_number(tokens[1], &scenario->duration_ms);
+
+	if (!strcmp(tokens[0], "pacing") && count == 2) {
+		if (!strcmp(tokens[1], "timer"))
+			scenario->paced = true;
+		else if (!strcmp(tokens[1], "vblank"))
+			scenario->paced = false;
+		else
+			return -EINVAL;
+
+		return 0;
+	}
+
+	if (!strcmp(tokens[0], "idle") && count == 2) {
+		if (!strcmp(tokens[1], "skip"))
+			scenario->idle_policy = DRM_DISPLAY_IDLE_SKIP;
+		else if (!strcmp(tokens[1], "commit"))
+			scenario->idle_policy = DRM_DISPLAY_IDLE_COMMIT;
+		else if (!strcmp(tokens[1], "stop"))
+			scenario->idle_policy = DRM_DISPLAY_IDLE_STOP;
+		else
+			return -EINVAL;
+
+		return 0;
+	}
+
+	/* Other statements apply to a plane. */
+	if (count < 2)
+		return -EINVAL;
+
+	plane = scenario_plane(scenario, tokens[1]);
+	if (!plane)
+		return -EINVAL;
+
+	if (!strcmp(tokens[0], "plane"))
+		return scenario_plane_parse(plane, tokens + 2, count - 2);
+
+	/* Animations refer to planes declared beforehand. */
+	if (!plane->used)
+		return -EINVAL;
+
+	if (!strcmp(tokens[0], "fill")) {
+		if (count < 3 || count - 2 > ARRAY_SIZE(plane->fill_colors))
+			return -EINVAL;
+
+		for (i = 2; i < count; i++) {
+			ret = scenario_number(tokens[i],
+					      &plane->fill_colors[i - 2]);
+			if (ret)
+				return ret;
+		}
+
+		plane->fill_colors_count = count - 2;
+
+		return 0;
+	}
+
+	if (!strcmp(tokens[0], "move") && count == 5) {
+		ret = scenario_position(tokens[2], &plane->move_x[0],
+					&plane->move_y[0]);
+		if (ret)
+			return ret;
+
+		ret = scenario_position(tokens[3], &plane->move_x[1],
+					&plane->move_y[1]);
+		if (ret)
+			return ret;
+
+		ret = scenario_number(tokens[4], &plane->move_period_ms);
+		if (ret || !plane->move_period_ms)
+			return -EINVAL;
+
+		plane->move = true;
+
+		return 0;
+	}
+
+	if (!strcmp(tokens[0], "scale") && count == 5) {
+		for (i = 0; i < 2; i++) {
+			ret = scenario_number(tokens[2 + i],
+					      &plane->scale_range[i]);
+			if (ret || !plane->scale_range[i])
+				return -EINVAL;
+		}
+
+		ret = scenario_number(tokens[4], &plane->scale_period_ms);
+		if (ret || !plane->scale_period_ms)
+			return -EINVAL;
+
+		plane->scale = true;
+
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+int drm_display_scenario_load(struct drm_display_scenario *scenario,
+			      const char *path)
+{
+	struct drm_display_scenario_plane *primary;
+	char line[512];
+	unsigned int number = 0;
+	FILE *file;
+	int ret = 0;
+
+	if (!scenario || !path)
+		return -EINVAL;
+
+	memset(scenario, 0, sizeof(*scenario));
+
+	scenario->duration_ms = 5000;
+	scenario->paced = true;
+
+	file = fopen(path, "r");
+	if (!file)
+		return -errno;
+
+	while (fgets(line, sizeof(line), file)) {
+		char *tokens[SCENARIO_TOKENS_MAX];
+		unsigned int count = 0;
+		char *state;
+		char *token;
+
+		number++;
+
+		token = strtok_r(line, " \t\r\n", &state);
+		while (token && count < ARRAY_SIZE(tokens)) {
+			tokens[count++] = token;
+			token = strtok_r(NULL, " \t\r\n", &state);
+		}
+
+		if (!count || tokens[0][0] == '#')
+			continue;
+
+		if (token)
+			ret = -EINVAL;
+		else
+			ret = scenario_statement_parse(scenario, tokens, count);
+
+		if (ret) {
+			scenario->error_line = number;
+			goto complete;
+		}
+	}
+
+	/* Something has to be shown on the primary plane. */
+	primary = &scenario->planes[DRM_DISPLAY_SCENARIO_PRIMARY];
+	if (!primary->used) {
+		primary->format = DRM_FORMAT_XRGB8888;
+		primary->rate = 60;
+		primary->used = true;
+	}
+
+complete:
+	fclose(file);
+
+	return ret;
+}
+
+static struct drm_display_plane_setup *scenario_plane_setup(struct drm_display *display,
+							     unsigned int role)
+{
+	switch (role) {
+	case DRM_DISPLAY_SCENARIO_PRIMARY:
+		return &display->primary_setup;
+	case DRM_DISPLAY_SCENARIO_OVERLAY:
+		return &display->overlay_setup;
+	case DRM_DISPLAY_SCENARIO_CURSOR:
+		return &display->cursor_setup;
+	default:
+		return NULL;
+	}
+}
+
+static struct drm_display_buffer *scenario_buffer_cycle(struct drm_display *display,
+							unsigned int role)
+{
+	switch (role) {
+	case DRM_DISPLAY_SCENARIO_PRIMARY:
+		return drm_display_primary_buffer_cycle(display);
+	case DRM_DISPLAY_SCENARIO_OVERLAY:
+		return drm_display_overlay_buffer_cycle(display);
+	case DRM_DISPLAY_SCENARIO_CURSOR:
+		return &display->cursor_buffer;
+	default:
+		return NULL;
+	}
+}
+
+/* Triangle wave between 0 and 1000 over the period. */
+static unsigned int scenario_wave(uint64_t time_us, unsigned int period_ms)
+{
+	unsigned int phase = (time_us / 1000) % period_ms;
+	unsigned int half = period_ms / 2;
+
+	if (!half)
+		return 0;
+
+	if (phase < half)
+		return phase * 1000 / half;
+
+	return (period_ms - phase) * 1000 / (period_ms - half);
+}
+
+static int scenario_animate(struct drm_display *display,
+			    struct drm_display_scenario_plane *plane,
+			    struct drm_display_plane_setup *plane_setup,
+			    uint64_t time_us)
+{
+	unsigned int wave;
+	int ret;
+
+	if (plane->move) {
+		int x, y;
+
+		wave = scenario_wave(time_us, plane->move_period_ms);
+		x = plane->move_x[0] +
+		    (plane->move_x[1] - plane->move_x[0]) * (int)wave / 1000;
+		y = plane->move_y[0] +
+		    (plane->move_y[1] - plane->move_y[0]) * (int)wave / 1000;
+
+		ret = drm_display_plane_move(display, plane_setup, x, y);
+		if (ret)
+			return ret;
+	}
+
+	if (plane->scale) {
+		unsigned int scale;
+
+		wave = scenario_wave(time_us, plane->scale_period_ms);
+		scale = plane->scale_range[0] +
+			((int)plane->scale_range[1] -
+			 (int)plane->scale_range[0]) * (int)wave / 1000;
+
+		ret = drm_display_plane_resize(display, plane_setup,
+					       plane_setup->buffer_width *
+					       scale / 1000,
+					       plane_setup->buffer_height *
+					       scale / 1000);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void scenario_commit_account(struct drm_display_scenario_stats *stats,
+				    uint64_t start_us)
+{
+	uint64_t commit_us = scenario_time_us() - start_us;
+
+	stats->commits++;
+	stats->commit_us += commit_us;
+
+	if (commit_us > stats->commit_us_max)
+		stats->commit_us_max = commit_us;
+}
+
+int drm_display_scenario_run(struct drm_display_scenario *scenario,
+			     struct drm_display *display,
+			     struct drm_display_scenario_stats *stats)
+{
+	struct drm_display_scenario_plane *plane;
+	struct drm_display_plane_setup *plane_setup;
+	struct drm_display_buffer *buffer;
+	uint64_t due_us[DRM_DISPLAY_SCENARIO_ROLES_COUNT] = { 0 };
+	uint64_t start_us, time_us, commit_us;
+	uint64_t next_us, refresh_us = 0;
+	unsigned int i;
+	bool animated = false;
+	bool submitted;
+	int ret;
+
+	if (!scenario || !display || !stats)
+		return -EINVAL;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < DRM_DISPLAY_SCENARIO_ROLES_COUNT; i++) {
+		plane = &scenario->planes[i];
+		if (!plane->used)
+			continue;
+
+		plane_setup = scenario_plane_setup(display, i);
+		plane_setup->buffer_format = plane->format;
+		plane_setup->buffer_width = plane->width;
+		plane_setup->buffer_height = plane->height;
+		plane_setup->display_x = plane->x;
+		plane_setup->display_y = plane->y;
+
+		if (plane->move || plane->scale)
+			animated = true;
+	}
+
+	display->primary_buffers_count =
+		scenario->planes[DRM_DISPLAY_SCENARIO_PRIMARY].buffers_count;
+	display->overlay_buffers_count =
+		scenario->planes[DRM_DISPLAY_SCENARIO_OVERLAY].buffers_count;
+	display->idle_policy = scenario->idle_policy;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < DRM_DISPLAY_SCENARIO_ROLES_COUNT; i++) {
+		if (!scenario->planes[i].used)
+			continue;
+
+		plane_setup = scenario_plane_setup(display, i);
+		if (!plane_setup->plane.id)
+			return -ENODEV;
+
+		if (!plane_setup->buffer_width || !plane_setup->buffer_height) {
+			plane_setup->buffer_width =
+				display->output.mode.hdisplay;
+			plane_setup->buffer_height =
+				display->output.mode.vdisplay;
+		}
+	}
+
+	/* Buffers created before a setup failure are released by setup. */
+	ret = drm_display_setup(display);
+	if (ret)
+		return ret;
+
+	if (display->output.mode.vrefresh)
+		refresh_us = 1000000 / display->output.mode.vrefresh;
+
+	start_us = scenario_time_us();
+
+	while (true) {
+		time_us = scenario_time_us() - start_us;
+		if (time_us >= (uint64_t)scenario->duration_ms * 1000)
+			break;
+
+		submitted = false;
+		next_us = UINT64_MAX;
+
+		for (i = 0; i < DRM_DISPLAY_SCENARIO_ROLES_COUNT; i++) {
+			uint64_t period_us;
+
+			plane = &scenario->planes[i];
+			if (!plane->used)
+				continue;
+
+			plane_setup = scenario_plane_setup(display, i);
+			period_us = 1000000 / plane->rate;
+
+			ret = scenario_animate(display, plane, plane_setup,
+					       time_us);
+			if (ret)
+				goto complete;
+
+			if (plane_setup->configured && time_us < due_us[i])
+				goto next_plane;
+
+			buffer = scenario_buffer_cycle(display, i);
+			if (!buffer) {
+				ret = -ENOMEM;
+				goto complete;
+			}
+
+			if (plane->fill_colors_count) {
+				unsigned int index = stats->frames[i] %
+						     plane->fill_colors_count;
+
+				drm_display_buffer_fill(buffer, NULL,
+							plane->fill_colors[index]);
+				drm_display_buffer_damage(buffer, 0, 0,
+							  buffer->width,
+							  buffer->height);
+			}
+
+			/* Configured planes are flipped together below. */
+			if (!plane_setup->configured) {
+				commit_us = scenario_time_us();
+
+				ret = drm_display_configure(display,
+							    plane_setup,
+							    buffer);
+				if (ret)
+					goto complete;
+
+				scenario_commit_account(stats, commit_us);
+				submitted = true;
+			} else {
+				ret = drm_display_page_flip_stage(display,
+								  plane_setup,
+								  buffer);
+				if (ret)
+					goto complete;
+			}
+
+			stats->frames[i]++;
+
+			/* Frames that could not be shown in time are lost. */
+			due_us[i] += period_us;
+			if (due_us[i] <= time_us) {
+				stats->frames_late[i]++;
+				due_us[i] = time_us + period_us;
+			}
+
+next_plane:
+			if (due_us[i] < next_us)
+				next_us = due_us[i];
+		}
+
+		/* Staged frames and animations of all planes, in one commit. */
+		if (drm_display_update_pending(display)) {
+			commit_us = scenario_time_us();
+
+			ret = drm_display_update(display);
+			if (ret)
+				goto complete;
+
+			scenario_commit_account(stats, commit_us);
+			submitted = true;
+		}
+
+		/* Blocking commits already wait for the next vblank. */
+		if (!scenario->paced && submitted)
+			continue;
+
+		time_us = scenario_time_us() - start_us;
+
+		/* Animations move on at least once per refresh. */
+		if (animated && refresh_us && next_us > time_us + refresh_us)
+			next_us = time_us + refresh_us;
+
+		if (next_us > time_us)
+			usleep(next_us - time_us);
+	}
+
+	stats->duration_us = scenario_time_us() - start_us;
+
+	ret = 0;
+
+complete:
+	drm_display_teardown(display);
+
+	return ret;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2026 Paul Kocialkowski <contact@paulk.fr>
+ */
+
+#ifndef _DRM_DISPLAY_SCENARIO_H_
+#define _DRM_DISPLAY_SCENARIO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <drm-display.h>
+
+enum drm_display_scenario_role {
+	DRM_DISPLAY_SCENARIO_PRIMARY = 0,
+	DRM_DISPLAY_SCENARIO_OVERLAY,
+	DRM_DISPLAY_SCENARIO_CURSOR,
+	DRM_DISPLAY_SCENARIO_ROLES_COUNT,
+};
+
+struct drm_display_scenario_plane {
+	bool used;
+
+	uint32_t format;
+	unsigned int width;
+	unsigned int height;
+	unsigned int buffers_count;
+	unsigned int rate;
+	int x;
+	int y;
+
+	/* Colors cycled through on each new frame. */
+	uint32_t fill_colors[8];
+	unsigned int fill_colors_count;
+
+	/* Back and forth between two positions, over a period in ms. */
+	bool move;
+	int move_x[2];
+	int move_y[2];
+	unsigned int move_period_ms;
+
+	/* Back and forth between two display scales in per-mille. */
+	bool scale;
+	unsigned int scale_range[2];
+	unsigned int scale_period_ms;
+};
+
+/*
+ * Scenarios are described by text files, one statement per line:
+ *
+ * duration <ms>
+ * pacing timer|vblank
+ * idle skip|commit|stop
+ * plane <role> <format> <width>x<height>|mode [buffers <n>] [rate <fps>]
+ *       [at <x>,<y>]
+ * fill <role> <color> [<color>...]
+ * move <role> <x>,<y> <x>,<y> <period ms>
+ * scale <role> <per-mille> <per-mille> <period ms>
+ *
+ * Roles are primary, overlay and cursor. Lines starting with # are ignored.
+ */
+struct drm_display_scenario {
+	struct drm_display_scenario_plane planes[DRM_DISPLAY_SCENARIO_ROLES_COUNT];
+
+	unsigned int duration_ms;
+	bool paced;
+	enum drm_display_idle_policy idle_policy;
+
+	/* Line of the first parsing error. */
+	unsigned int error_line;
+};
+
+struct drm_display_scenario_stats {
+	unsigned int frames[DRM_DISPLAY_SCENARIO_ROLES_COUNT];
+	unsigned int frames_late[DRM_DISPLAY_SCENARIO_ROLES_COUNT];
+
+	unsigned int commits;
+	uint64_t commit_us;
+	uint64_t commit_us_max;
+
+	uint64_t duration_us;
+};
+
+int drm_display_scenario_load(struct drm_display_scenario *scenario,
+			      const char *path);
+int drm_display_scenario_run(struct drm_display_scenario *scenario,
+			     struct drm_display *display,
+			     struct drm_display_scenario_stats *stats);
+
+#endif
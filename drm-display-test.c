@@ -8,8 +8,31 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
 
 #include <drm-display.h>
+#include <drm-display-presenter.h>
+#include <drm-display-lease.h>
+#include <drm-display-scenario.h>
+#include <drm-display-recorder.h>
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+/* Extra command line argument, for tests that take one. */
+static const char *test_argument;
+
+static uint64_t time_us(void)
+{
+	struct timespec timespec = { 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &timespec);
+
+	return (uint64_t)timespec.tv_sec * 1000000 + timespec.tv_nsec / 1000;
+}
 
 static int test_color(struct drm_display *display)
 {
@@ -61,16 +84,1545 @@ static int test_color(struct drm_display *display)
 		return ret;
 }
 
-int main(int argc, char *argv[])
+static int test_shadow_run(struct drm_display *display, bool shadow)
 {
-	struct drm_display display = { 0 };
+	struct drm_display_buffer *buffer;
+	unsigned int frames = 120;
+	uint64_t render_us = 0;
+	uint64_t present_us = 0;
+	uint64_t start;
+	unsigned int i, j;
+	int ret;
+
+	display->primary_setup.buffer_shadow = shadow;
+
+	ret = drm_display_setup(display);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < frames; i++) {
+		unsigned int width, height;
+		cairo_t *cairo;
+
+		buffer = drm_display_primary_buffer_cycle(display);
+		if (!buffer)
+			return 1;
+
+		width = buffer->width;
+		height = buffer->height;
+
+		start = time_us();
+
+		cairo = drm_display_buffer_cairo(buffer);
+		if (!cairo)
+			return 1;
+
+		/* Translucent layers force the rasteriser to read back. */
+		cairo_set_source_rgba(cairo, 0.2, 0.3, 0.4, 0.5);
+		cairo_paint(cairo);
+
+		for (j = 0; j < 16; j++) {
+			cairo_new_path(cairo);
+			cairo_arc(cairo, (width * (j + i % 16)) / 32,
+				  height / 2, height / 4, 0, 2 * M_PI);
+			cairo_set_source_rgba(cairo, (j % 4) / 4.0,
+					      (j % 3) / 3.0, 0.5, 0.25);
+			cairo_fill(cairo);
+		}
+
+		render_us += time_us() - start;
+
+		start = time_us();
+
+		if (!display->primary_setup.configured)
+			ret = drm_display_configure(display,
+						    &display->primary_setup,
+						    buffer);
+		else
+			ret = drm_display_page_flip(display,
+						    &display->primary_setup,
+						    buffer);
+		if (ret)
+			return ret;
+
+		present_us += time_us() - start;
+	}
+
+	printf("%s rendering: %.2f ms render, %.2f ms present per frame\n",
+	       shadow ? "Shadowed" : "Direct",
+	       (double)render_us / frames / 1000,
+	       (double)present_us / frames / 1000);
+
+	return drm_display_teardown(display);
+}
+
+static int test_shadow(struct drm_display *display)
+{
+	int ret;
+
+	display->primary_setup.buffer_format = DRM_FORMAT_XRGB8888;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	ret = test_shadow_run(display, false);
+	if (ret)
+		return ret;
+
+	ret = test_shadow_run(display, true);
+	if (ret)
+		return ret;
+
+	return 0;
+}
+
+static int test_presenter_run(struct drm_display *display,
+			      enum drm_display_presenter_mode mode)
+{
+	struct drm_display_presenter presenter = { 0 };
+	struct drm_display_presenter_stats stats = { 0 };
+	struct drm_display_buffer *buffer;
+	unsigned int frames = 180;
+	unsigned int i;
+	int ret;
+
+	display->primary_setup.buffer_format = DRM_FORMAT_XRGB8888;
+
+	/* Mailbox needs a buffer to render while another one is queued. */
+	if (mode == DRM_DISPLAY_PRESENTER_MAILBOX)
+		display->primary_buffers_count = 3;
+
+	presenter.mode = mode;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	ret = drm_display_setup(display);
+	if (ret)
+		return ret;
+
+	ret = drm_display_presenter_start(&presenter, display,
+					  &display->primary_setup,
+					  display->primary_buffers,
+					  display->primary_buffers_count);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < frames; i++) {
+		uint8_t level = (i * 255) / frames;
+
+		while (!(buffer = drm_display_presenter_buffer_acquire(&presenter)))
+			usleep(1000);
+
+		drm_display_buffer_fill(buffer, NULL,
+					level << 16 | level << 8 | level);
+
+		ret = drm_display_presenter_buffer_present(&presenter, buffer);
+		if (ret)
+			break;
+	}
+
+	drm_display_presenter_stop(&presenter);
+	drm_display_presenter_stats(&presenter, &stats);
+
+	printf("Presented %u frames, %u superseded, %u dropped\n",
+	       stats.presented, stats.superseded, stats.dropped);
+
+	if (ret)
+		return ret;
+
+	return drm_display_teardown(display);
+}
+
+static int test_presenter(struct drm_display *display)
+{
+	return test_presenter_run(display, DRM_DISPLAY_PRESENTER_FIFO);
+}
+
+static int test_mailbox(struct drm_display *display)
+{
+	return test_presenter_run(display, DRM_DISPLAY_PRESENTER_MAILBOX);
+}
+
+static int test_hash(struct drm_display *display)
+{
+	struct drm_display_rect rect = { 0 };
+	struct drm_display_buffer *buffer;
+	unsigned int frames = 60;
+	uint64_t full_us = 0;
+	uint64_t damage_us = 0;
+	uint64_t start;
+	uint32_t hash;
+	unsigned int i;
+	int ret;
+
+	display->primary_setup.buffer_format = DRM_FORMAT_XRGB8888;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	ret = drm_display_setup(display);
+	if (ret)
+		return ret;
+
+	buffer = drm_display_primary_buffer_cycle(display);
+	if (!buffer)
+		return 1;
+
+	for (i = 0; i < frames; i++) {
+		drm_display_buffer_fill(buffer, NULL, 0x00336699 + i);
+
+		/* Full damage forces a full rehash. */
+		drm_display_buffer_damage_full(buffer);
+
+		start = time_us();
+
+		ret = drm_display_buffer_hash(buffer, &hash);
+		if (ret)
+			return ret;
+
+		full_us += time_us() - start;
+
+		rect.x = (i * 32) % buffer->width;
+		rect.y = (i * 32) % buffer->height;
+		rect.width = 64;
+		rect.height = 64;
+
+		drm_display_buffer_fill(buffer, &rect, 0x00ff0000);
+		drm_display_buffer_damage(buffer, rect.x, rect.y, rect.width,
+					  rect.height);
+
+		start = time_us();
+
+		ret = drm_display_buffer_hash(buffer, &hash);
+		if (ret)
+			return ret;
+
+		damage_us += time_us() - start;
+	}
+
+	printf("Hashing: %.2f ms full, %.2f ms damaged per frame\n",
+	       (double)full_us / frames / 1000,
+	       (double)damage_us / frames / 1000);
+
+	return drm_display_teardown(display);
+}
+
+static int test_writeback(struct drm_display *display)
+{
+	struct drm_display_buffer *buffer;
+	struct drm_display_buffer *capture;
+	unsigned int frames = 30;
+	uint32_t hash;
+	unsigned int i;
+	int ret;
+
+	display->primary_setup.buffer_format = DRM_FORMAT_XRGB8888;
+	display->writeback.buffer_format = DRM_FORMAT_XRGB8888;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	if (!display->writeback.connector_id) {
+		fprintf(stderr, "No writeback connector available\n");
+		return 1;
+	}
+
+	ret = drm_display_setup(display);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < frames; i++) {
+		buffer = drm_display_primary_buffer_cycle(display);
+		if (!buffer)
+			return 1;
+
+		drm_display_buffer_fill(buffer, NULL, 0x00102030 * (i % 8));
+
+		ret = drm_display_writeback_capture(display);
+		if (ret)
+			return ret;
+
+		if (!display->primary_setup.configured)
+			ret = drm_display_configure(display,
+						    &display->primary_setup,
+						    buffer);
+		else
+			ret = drm_display_page_flip(display,
+						    &display->primary_setup,
+						    buffer);
+		if (ret)
+			return ret;
+
+		capture = drm_display_writeback_wait(display, 1000);
+		if (!capture)
+			return 1;
+
+		ret = drm_display_buffer_hash(capture, &hash);
+		if (ret)
+			return ret;
+
+		printf("Frame %u captured with hash %08x\n", i, hash);
+
+		ret = drm_display_writeback_release(display, capture);
+		if (ret)
+			return ret;
+	}
+
+	return drm_display_teardown(display);
+}
+
+static int test_pan(struct drm_display *display)
+{
+	struct drm_display_plane_setup *plane_setup = &display->primary_setup;
+	struct drm_display_rect rect = { 0 };
+	struct drm_display_buffer *buffer;
+	unsigned int width, height;
+	unsigned int x;
+	int ret;
+
+	plane_setup->buffer_format = DRM_FORMAT_XRGB8888;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	/* Pan a visible window over a canvas twice as wide as the mode. */
+	width = plane_setup->buffer_width;
+	height = plane_setup->buffer_height;
+
+	plane_setup->buffer_width = width * 2;
+	plane_setup->source_width = width;
+	plane_setup->source_height = height;
+	plane_setup->display_width = width;
+	plane_setup->display_height = height;
+
+	ret = drm_display_setup(display);
+	if (ret)
+		return ret;
+
+	buffer = drm_display_primary_buffer_cycle(display);
+	if (!buffer)
+		return 1;
+
+	rect.width = 64;
+	rect.height = height;
+
+	for (rect.x = 0; rect.x < buffer->width; rect.x += rect.width) {
+		uint32_t color = (rect.x / rect.width) % 2 ? 0x00ffffff :
+			0x00336699;
+
+		drm_display_buffer_fill(buffer, &rect, color);
+	}
+
+	ret = drm_display_configure(display, plane_setup, buffer);
+	if (ret)
+		return ret;
+
+	for (x = 0; x <= width; x += 4) {
+		ret = drm_display_plane_pan(display, plane_setup, x, 0);
+		if (ret)
+			return ret;
+
+		ret = drm_display_update(display);
+		if (ret)
+			return ret;
+	}
+
+	return drm_display_teardown(display);
+}
+
+static int test_dynamic_resolution(struct drm_display *display)
+{
+	struct drm_display_plane_setup *plane_setup = &display->primary_setup;
+	struct drm_display_dynamic_resolution *dynamic_resolution =
+		&plane_setup->dynamic_resolution;
+	struct drm_display_rect rect = { 0 };
+	struct drm_display_buffer *buffer;
+	unsigned int budget_us = 16000;
+	unsigned int render_us;
+	unsigned int scale = 0;
+	unsigned int i;
+	int ret;
+
+	plane_setup->buffer_format = DRM_FORMAT_XRGB8888;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	dynamic_resolution->enabled = true;
+	dynamic_resolution->budget_us = budget_us;
+
+	ret = drm_display_setup(display);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < 240; i++) {
+		buffer = drm_display_primary_buffer_cycle(display);
+		if (!buffer)
+			return 1;
+
+		/* Only render what the source rectangle shows. */
+		rect.x = plane_setup->source_x;
+		rect.y = plane_setup->source_y;
+		rect.width = plane_setup->source_width;
+		rect.height = plane_setup->source_height;
+
+		drm_display_buffer_fill(buffer, &rect, 0x00010101 * (i % 256));
+
+		if (!plane_setup->configured)
+			ret = drm_display_configure(display, plane_setup,
+						    buffer);
+		else
+			ret = drm_display_page_flip(display, plane_setup,
+						    buffer);
+		if (ret)
+			return ret;
+
+		/* Pan to the far corner so that growing back has to clamp. */
+		if (i == 60) {
+			ret = drm_display_plane_pan(display, plane_setup,
+						    plane_setup->buffer_width -
+						    plane_setup->source_width,
+						    plane_setup->buffer_height -
+						    plane_setup->source_height);
+			if (ret)
+				return ret;
+		}
+
+		/* Synthetic load: overshoot the budget, then leave headroom. */
+		render_us = i < 120 ? budget_us * 3 / 2 : budget_us / 2;
+
+		ret = drm_display_dynamic_resolution_update(display,
+							    plane_setup,
+							    render_us);
+		if (ret)
+			return ret;
+
+		if (dynamic_resolution->scale == scale)
+			continue;
+
+		scale = dynamic_resolution->scale;
+
+		printf("Frame %u: scale %u, source %ux%u at %u,%u\n", i, scale,
+		       plane_setup->source_width, plane_setup->source_height,
+		       plane_setup->source_x, plane_setup->source_y);
+	}
+
+	return drm_display_teardown(display);
+}
+
+static int test_cursor(struct drm_display *display)
+{
+	struct drm_display_plane_setup *plane_setup = &display->primary_setup;
+	struct drm_display_buffer *buffer;
+	unsigned int width, height;
+	unsigned int i, j;
+	double angle;
+	int x, y;
+	int ret;
+
+	plane_setup->buffer_format = DRM_FORMAT_XRGB8888;
+	display->cursor_setup.buffer_format = DRM_FORMAT_ARGB8888;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	if (!display->cursor_setup.plane.id) {
+		fprintf(stderr, "No cursor plane available\n");
+		return 1;
+	}
+
+	ret = drm_display_setup(display);
+	if (ret)
+		return ret;
+
+	buffer = drm_display_primary_buffer_cycle(display);
+	if (!buffer)
+		return 1;
+
+	drm_display_buffer_fill(buffer, NULL, 0x00336699);
+
+	ret = drm_display_configure(display, plane_setup, buffer);
+	if (ret)
+		return ret;
+
+	drm_display_buffer_fill(&display->cursor_buffer, NULL, 0xffffffff);
+
+	ret = drm_display_configure(display, &display->cursor_setup,
+				    &display->cursor_buffer);
+	if (ret)
+		return ret;
+
+	width = plane_setup->buffer_width - display->cursor_setup.buffer_width;
+	height = plane_setup->buffer_height -
+		 display->cursor_setup.buffer_height;
+
+	/*
+	 * Several moves per frame: the first one goes out on its own and the
+	 * following ones find it in flight and get folded into the next flip.
+	 */
+	for (i = 0; i < 120; i++) {
+		for (j = 0; j < 4; j++) {
+			angle = 2 * M_PI * (i * 4 + j) / 240;
+			x = width / 2 * (1 + cos(angle));
+			y = height / 2 * (1 + sin(angle));
+
+			ret = drm_display_cursor_move(display, x, y);
+			if (ret)
+				return ret;
+		}
+
+		buffer = drm_display_primary_buffer_cycle(display);
+		if (!buffer)
+			return 1;
+
+		drm_display_buffer_fill(buffer, NULL, 0x00010101 * (i % 256));
+
+		ret = drm_display_page_flip(display, plane_setup, buffer);
+		if (ret)
+			return ret;
+	}
+
+	printf("Cursor moves: %u committed, %u folded into flips\n",
+	       display->stats.cursor_moves_committed,
+	       display->stats.cursor_moves_folded);
+
+	return drm_display_teardown(display);
+}
+
+static double test_lut_gamma(double value, unsigned int channel,
+			     void *private)
+{
+	return pow(value, *(double *)private);
+}
+
+/* Read back the blob that the CRTC property points to after the commit. */
+static int test_lut_check(struct drm_display *display, uint32_t property_id,
+			  const void *data, size_t size)
+{
+	drmModeObjectPropertiesPtr properties;
+	drmModePropertyBlobPtr blob = NULL;
+	uint32_t blob_id = 0;
+	unsigned int i;
+	int ret = -ENOENT;
+
+	properties = drmModeObjectGetProperties(display->drm_fd,
+						display->output.crtc_id,
+						DRM_MODE_OBJECT_CRTC);
+	if (!properties)
+		return -errno;
+
+	for (i = 0; i < properties->count_props; i++)
+		if (properties->props[i] == property_id)
+			blob_id = properties->prop_values[i];
+
+	if (blob_id)
+		blob = drmModeGetPropertyBlob(display->drm_fd, blob_id);
+
+	if (blob) {
+		ret = blob->length == size && !memcmp(blob->data, data, size) ?
+		      0 : -EINVAL;
+		drmModeFreePropertyBlob(blob);
+	}
+
+	drmModeFreeObjectProperties(properties);
+
+	return ret;
+}
+
+static void test_lut_expected(struct drm_color_lut *lut, unsigned int size,
+			      double exponent)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++) {
+		double value = pow((double)i / (size - 1), exponent);
+		uint16_t entry = value * 0xffff + 0.5;
+
+		lut[i].red = entry;
+		lut[i].green = entry;
+		lut[i].blue = entry;
+		lut[i].reserved = 0;
+	}
+}
+
+static int test_lut(struct drm_display *display)
+{
+	struct drm_display_crtc_properties *crtc_properties =
+		&display->output.crtc_properties;
+	/* Swap red and blue, with a negative term to cover the sign bit. */
+	const double matrix[9] = {
+		0.0, 0.0, 1.0,
+		0.0, 1.0, 0.0,
+		1.0, 0.0, -0.25,
+	};
+	struct drm_display_buffer *buffer;
+	struct drm_color_ctm ctm = { 0 };
+	struct drm_color_lut *lut;
+	double gamma = 1 / 2.2;
+	double degamma = 2.2;
+	unsigned int size;
+	unsigned int i;
 	int ret;
 
+	display->primary_setup.buffer_format = DRM_FORMAT_XRGB8888;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	ret = drm_display_setup(display);
+	if (ret)
+		return ret;
+
+	buffer = drm_display_primary_buffer_cycle(display);
+	if (!buffer)
+		return 1;
+
+	drm_display_buffer_fill(buffer, NULL, 0x00ff8000);
+
+	ret = drm_display_configure(display, &display->primary_setup, buffer);
+	if (ret)
+		return ret;
+
+	ret = drm_display_gamma_lut_set(display, test_lut_gamma, &gamma);
+	if (ret && ret != -EOPNOTSUPP)
+		return ret;
+
+	ret = drm_display_degamma_lut_set(display, test_lut_gamma, &degamma);
+	if (ret && ret != -EOPNOTSUPP)
+		return ret;
+
+	ret = drm_display_ctm_set(display, matrix);
+	if (ret && ret != -EOPNOTSUPP)
+		return ret;
+
+	ret = drm_display_update(display);
+	if (ret)
+		return ret;
+
+	size = display->output.gamma_lut_size;
+	if (display->output.degamma_lut_size > size)
+		size = display->output.degamma_lut_size;
+
+	lut = calloc(size ? size : 1, sizeof(*lut));
+	if (!lut)
+		return 1;
+
+	if (crtc_properties->gamma_lut) {
+		size = display->output.gamma_lut_size;
+		test_lut_expected(lut, size, gamma);
+
+		ret = test_lut_check(display, crtc_properties->gamma_lut, lut,
+				     size * sizeof(*lut));
+		printf("Gamma LUT (%u entries): %s\n", size,
+		       ret ? "mismatch" : "match");
+		if (ret)
+			goto complete;
+	}
+
+	if (crtc_properties->degamma_lut) {
+		size = display->output.degamma_lut_size;
+		test_lut_expected(lut, size, degamma);
+
+		ret = test_lut_check(display, crtc_properties->degamma_lut,
+				     lut, size * sizeof(*lut));
+		printf("Degamma LUT (%u entries): %s\n", size,
+		       ret ? "mismatch" : "match");
+		if (ret)
+			goto complete;
+	}
+
+	if (crtc_properties->ctm) {
+		for (i = 0; i < ARRAY_SIZE(matrix); i++)
+			ctm.matrix[i] = (matrix[i] < 0 ? 1ULL << 63 : 0) |
+					(uint64_t)(fabs(matrix[i]) *
+						   (1ULL << 32));
+
+		ret = test_lut_check(display, crtc_properties->ctm, &ctm,
+				     sizeof(ctm));
+		printf("CTM: %s\n", ret ? "mismatch" : "match");
+		if (ret)
+			goto complete;
+	}
+
+	printf("Press enter to continue ");
+	getchar();
+
+	/* Back to a linear pipeline. */
+	drm_display_gamma_lut_set(display, NULL, NULL);
+	drm_display_degamma_lut_set(display, NULL, NULL);
+	drm_display_ctm_set(display, NULL);
+
+	ret = drm_display_update(display);
+
+complete:
+	free(lut);
+
+	if (ret)
+		return ret;
+
+	return drm_display_teardown(display);
+}
+
+static int test_fb_cache_run(struct drm_display *display,
+			     struct drm_display_buffer *buffers, int *fds,
+			     unsigned int count, unsigned int capacity)
+{
+	struct drm_display_plane_setup *plane_setup = &display->primary_setup;
+	struct drm_display_fb_cache_stats *stats = &display->fb_cache.stats;
+	struct drm_display_buffer *buffer;
+	unsigned int frames = 120;
+	uint64_t start;
+	unsigned int i;
+	int ret;
+
+	display->fb_cache.capacity = capacity;
+	memset(stats, 0, sizeof(*stats));
+
+	start = time_us();
+
+	for (i = 0; i < frames; i++) {
+		struct drm_display_buffer *source = &buffers[i % count];
+
+		buffer = drm_display_buffer_import(display, fds[i % count],
+						   source->width,
+						   source->height,
+						   source->format,
+						   source->strides,
+						   source->offsets);
+		if (!buffer)
+			return 1;
+
+		if (!plane_setup->configured)
+			ret = drm_display_configure(display, plane_setup,
+						    buffer);
+		else
+			ret = drm_display_page_flip(display, plane_setup,
+						    buffer);
+		if (ret)
+			return ret;
+
+		drm_display_buffer_release(display, buffer);
+	}
+
+	printf("Cache %s: %.2f framebuffer ioctls, %.2f ms per frame, %u/%u hits\n",
+	       capacity ? "on" : "off", (double)stats->ioctls / frames,
+	       (double)(time_us() - start) / frames / 1000, stats->hits,
+	       stats->lookups);
+
+	return 0;
+}
+
+static int test_fb_cache(struct drm_display *display)
+{
+	struct drm_display_plane_setup *plane_setup = &display->primary_setup;
+	struct drm_display_plane_setup producer_setup;
+	struct drm_display producer = { 0 };
+	struct drm_display_buffer buffers[4] = { 0 };
+	uint32_t colors[4] = { 0x00ff0000, 0x0000ff00, 0x000000ff, 0x00ffffff };
+	int fds[4] = { -1, -1, -1, -1 };
+	unsigned int count = ARRAY_SIZE(buffers);
+	unsigned int i;
+	int ret;
+
+	plane_setup->buffer_format = DRM_FORMAT_XRGB8888;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	ret = drm_display_setup(display);
+	if (ret)
+		return ret;
+
+	/* Buffers of a separate device file stand for a decoder's pool. */
+	ret = drm_display_open(&producer);
+	if (ret || producer.drm_fd < 0)
+		return 1;
+
+	producer_setup = *plane_setup;
+	producer_setup.buffer_usage = DRM_DISPLAY_BUFFER_USAGE_EXPORT;
+	producer_setup.buffer_shadow = false;
+
+	for (i = 0; i < count; i++) {
+		ret = drm_display_buffer_setup(&producer, &buffers[i],
+					       &producer_setup);
+		if (ret)
+			goto complete;
+
+		ret = drm_display_buffer_dma_buf_export(&producer, &buffers[i],
+							&fds[i]);
+		if (ret)
+			goto complete;
+
+		ret = drm_display_buffer_map(&producer, &buffers[i]);
+		if (ret)
+			goto complete;
+
+		drm_display_buffer_fill(&buffers[i], NULL, colors[i]);
+		drm_display_buffer_unmap(&producer, &buffers[i]);
+	}
+
+	ret = test_fb_cache_run(display, buffers, fds, count, 0);
+	if (ret)
+		goto complete;
+
+	ret = test_fb_cache_run(display, buffers, fds, count, count);
+	if (ret)
+		goto complete;
+
+	ret = drm_display_teardown(display);
+
+complete:
+	for (i = 0; i < count; i++) {
+		if (fds[i] >= 0)
+			close(fds[i]);
+
+		if (buffers[i].fb_id)
+			drm_display_buffer_teardown(&producer, &buffers[i]);
+	}
+
+	drm_display_close(&producer);
+
+	return ret;
+}
+
+static int test_blend(struct drm_display *display)
+{
+	struct drm_display_plane_setup *plane_setup = &display->overlay_setup;
+	struct drm_display_buffer *buffer;
+	unsigned int width, height;
+	int ret;
+
+	display->primary_setup.buffer_format = DRM_FORMAT_XRGB8888;
+	plane_setup->buffer_format = DRM_FORMAT_ARGB8888;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	if (!plane_setup->plane.id) {
+		fprintf(stderr, "No ARGB8888 overlay plane\n");
+		return 1;
+	}
+
+	width = display->primary_setup.buffer_width;
+	height = display->primary_setup.buffer_height;
+
+	plane_setup->buffer_width = width / 2;
+	plane_setup->buffer_height = height / 2;
+	plane_setup->display_x = width / 4;
+	plane_setup->display_y = height / 4;
+
+	ret = drm_display_setup(display);
+	if (ret)
+		return ret;
+
+	buffer = drm_display_primary_buffer_cycle(display);
+	if (!buffer)
+		return 1;
+
+	drm_display_buffer_fill(buffer, NULL, 0x00336699);
+
+	ret = drm_display_configure(display, &display->primary_setup, buffer);
+	if (ret)
+		return ret;
+
+	buffer = drm_display_overlay_buffer_cycle(display);
+	if (!buffer)
+		return 1;
+
+	/* Translucent orange, with colour components pre-multiplied. */
+	drm_display_buffer_fill(buffer, NULL, 0x80804000);
+
+	ret = drm_display_plane_zpos_set(display, plane_setup,
+					 plane_setup->plane.zpos_max);
+	printf("Overlay zpos: %s\n", ret ? "fixed" : "set on top");
+
+	ret = drm_display_plane_alpha_set(display, plane_setup, 0xc000);
+	printf("Overlay alpha: %s\n", ret ? "unsupported" : "75%");
+
+	ret = drm_display_plane_blend_mode_set(display, plane_setup,
+					       DRM_DISPLAY_BLEND_PREMULTIPLIED);
+	printf("Overlay blend mode: %s\n",
+	       ret ? "unsupported" : "pre-multiplied");
+
+	ret = drm_display_configure(display, plane_setup, buffer);
+	if (ret)
+		return ret;
+
+	printf("Press enter to continue ");
+	getchar();
+
+	/* Switch blending off without a new overlay buffer. */
+	if (!drm_display_plane_blend_mode_set(display, plane_setup,
+					      DRM_DISPLAY_BLEND_NONE)) {
+		ret = drm_display_update(display);
+		if (ret)
+			return ret;
+	}
+
+	return drm_display_teardown(display);
+}
+
+static void test_rotate_naive(struct drm_display_buffer *destination,
+			      const struct drm_display_buffer *source)
+{
+	unsigned int x, y;
+
+	/* Counter-clockwise, pixel by pixel in source order. */
+	for (y = 0; y < source->height; y++) {
+		const uint32_t *line = source->data[0] + y * source->strides[0];
+
+		for (x = 0; x < source->width; x++) {
+			uint8_t *data = destination->data[0] +
+					(source->width - 1 - x) *
+					destination->strides[0];
+
+			((uint32_t *)data)[y] = line[x];
+		}
+	}
+}
+
+static int test_rotate_run(struct drm_display *display,
+			   struct drm_display_buffer *content, bool naive)
+{
+	struct drm_display_plane_setup *plane_setup = &display->primary_setup;
+	struct drm_display_buffer *buffer;
+	unsigned int frames = 60;
+	uint64_t rotate_us = 0;
+	uint64_t start;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < frames; i++) {
+		buffer = drm_display_primary_buffer_cycle(display);
+		if (!buffer)
+			return 1;
+
+		start = time_us();
+
+		if (naive)
+			test_rotate_naive(buffer, content);
+		else
+			drm_display_buffer_rotate(buffer, content,
+						  DRM_MODE_ROTATE_90);
+
+		rotate_us += time_us() - start;
+
+		if (!plane_setup->configured)
+			ret = drm_display_configure(display, plane_setup,
+						    buffer);
+		else
+			ret = drm_display_page_flip(display, plane_setup,
+						    buffer);
+		if (ret)
+			return ret;
+	}
+
+	printf("%s rotation: %.2f ms per frame\n",
+	       naive ? "Naive CPU" : "Blocked CPU",
+	       (double)rotate_us / frames / 1000);
+
+	return 0;
+}
+
+static int test_rotate(struct drm_display *display)
+{
+	struct drm_display_plane_setup *plane_setup = &display->primary_setup;
+	struct drm_display_plane_setup plane_setup_new;
+	struct drm_display_buffer content = { 0 };
+	struct drm_display_rect rect = { 0 };
+	struct drm_display_buffer *buffer;
+	unsigned int width, height;
+	unsigned int frames = 60;
+	uint64_t copy_us = 0;
+	uint64_t start;
+	unsigned int i;
+	int ret;
+
+	plane_setup->buffer_format = DRM_FORMAT_XRGB8888;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	width = plane_setup->buffer_width;
+	height = plane_setup->buffer_height;
+
+	/* Portrait content, as drawn for a panel mounted on its side. */
+	content.width = height;
+	content.height = width;
+	content.format = DRM_FORMAT_XRGB8888;
+	content.strides[0] = content.width * 4;
+	content.data[0] = malloc(content.strides[0] * content.height);
+	if (!content.data[0])
+		return 1;
+
+	rect.width = content.width;
+	rect.height = 64;
+
+	for (rect.y = 0; rect.y < content.height; rect.y += rect.height)
+		drm_display_buffer_fill(&content, &rect,
+					(rect.y / rect.height) % 2 ?
+					0x00ffffff : 0x00993366);
+
+	plane_setup->buffer_width = content.width;
+	plane_setup->buffer_height = content.height;
+	plane_setup->display_width = width;
+	plane_setup->display_height = height;
+
+	ret = drm_display_setup(display);
+	if (ret)
+		goto complete;
+
+	ret = drm_display_plane_rotation_set(display, plane_setup,
+					     DRM_MODE_ROTATE_90);
+	if (!ret) {
+		for (i = 0; i < frames; i++) {
+			buffer = drm_display_primary_buffer_cycle(display);
+			if (!buffer) {
+				ret = 1;
+				goto complete;
+			}
+
+			/* Only the CPU side is timed, like for CPU rotation. */
+			start = time_us();
+
+			drm_display_buffer_rotate(buffer, &content,
+						  DRM_MODE_ROTATE_0);
+
+			copy_us += time_us() - start;
+
+			if (!plane_setup->configured)
+				ret = drm_display_configure(display,
+							    plane_setup,
+							    buffer);
+			else
+				ret = drm_display_page_flip(display,
+							    plane_setup,
+							    buffer);
+			if (ret)
+				goto complete;
+		}
+
+		printf("Hardware rotation: %.2f ms per frame\n",
+		       (double)copy_us / frames / 1000);
+	} else {
+		printf("Hardware rotation unavailable: %s\n", strerror(-ret));
+	}
+
+	/* Fall back to landscape buffers rotated by the CPU. */
+	plane_setup_new = *plane_setup;
+	plane_setup_new.buffer_width = width;
+	plane_setup_new.buffer_height = height;
+	plane_setup_new.source_width = width;
+	plane_setup_new.source_height = height;
+	plane_setup_new.rotation = DRM_MODE_ROTATE_0;
+
+	ret = drm_display_reconfigure(display, plane_setup, &plane_setup_new);
+	if (ret)
+		goto complete;
+
+	ret = test_rotate_run(display, &content, true);
+	if (ret)
+		goto complete;
+
+	ret = test_rotate_run(display, &content, false);
+	if (ret)
+		goto complete;
+
+	ret = drm_display_teardown(display);
+
+complete:
+	free(content.data[0]);
+
+	return ret;
+}
+
+/* Red channel of the centre pixel, to tell carried over content from black. */
+static unsigned int test_reconfigure_red(struct drm_display_buffer *buffer)
+{
+	uint8_t *pixel;
+
+	if (!buffer->data[0])
+		return 0;
+
+	pixel = (uint8_t *)buffer->data[0] +
+		buffer->height / 2 * buffer->strides[0];
+
+	if (buffer->format == DRM_FORMAT_RGB565)
+		return (*(uint16_t *)(pixel + buffer->width / 2 * 2) >> 11) << 3;
+
+	return (*(uint32_t *)(pixel + buffer->width / 2 * 4) >> 16) & 0xff;
+}
+
+static int test_reconfigure(struct drm_display *display)
+{
+	struct drm_display_plane_setup *plane_setup = &display->primary_setup;
+	struct drm_display_plane_setup plane_setup_new;
+	struct drm_display_buffer *buffer;
+	unsigned int width, height;
+	const struct {
+		unsigned int divider;
+		uint32_t format;
+	} steps[] = {
+		{ 2, DRM_FORMAT_XRGB8888 },
+		{ 2, DRM_FORMAT_RGB565 },
+		{ 1, DRM_FORMAT_XRGB8888 },
+	};
+	uint64_t start;
+	cairo_t *cairo;
+	unsigned int i;
+	int ret;
+
+	plane_setup->buffer_format = DRM_FORMAT_XRGB8888;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	width = plane_setup->buffer_width;
+	height = plane_setup->buffer_height;
+
+	ret = drm_display_setup(display);
+	if (ret)
+		return ret;
+
+	buffer = drm_display_primary_buffer_cycle(display);
+	if (!buffer)
+		return 1;
+
+	drm_display_buffer_fill(buffer, NULL, 0x00000000);
+
+	/* Keep the console content when the output is already lit up. */
+	ret = drm_display_takeover(display, buffer);
+	if (ret == -EINVAL) {
+		printf("Output is not lit up, configuring instead\n");
+		ret = drm_display_configure(display, plane_setup, buffer);
+	} else if (!ret) {
+		printf("Took over the output without a modeset\n");
+	}
+
+	if (ret)
+		return ret;
+
+	printf("Press enter to continue ");
+	getchar();
+
+	buffer = drm_display_primary_buffer_cycle(display);
+	if (!buffer)
+		return 1;
+
+	cairo = drm_display_buffer_cairo(buffer);
+	if (!cairo)
+		return 1;
+
+	cairo_set_source_rgb(cairo, 1.0, 0.5, 0.0);
+	cairo_paint(cairo);
+	cairo_set_source_rgb(cairo, 0.0, 0.3, 0.6);
+	cairo_set_line_width(cairo, height / 8);
+	cairo_move_to(cairo, 0, height / 4);
+	cairo_line_to(cairo, width, height / 4);
+	cairo_stroke(cairo);
+	cairo_surface_flush(cairo_get_target(cairo));
+
+	ret = drm_display_page_flip(display, plane_setup, buffer);
+	if (ret)
+		return ret;
+
+	/* The plane keeps covering the whole mode while buffers change. */
+	for (i = 0; i < ARRAY_SIZE(steps); i++) {
+		plane_setup_new = *plane_setup;
+		plane_setup_new.buffer_width = width / steps[i].divider;
+		plane_setup_new.buffer_height = height / steps[i].divider;
+		plane_setup_new.buffer_format = steps[i].format;
+		plane_setup_new.source_width = 0;
+		plane_setup_new.source_height = 0;
+		plane_setup_new.source_x = 0;
+		plane_setup_new.source_y = 0;
+		plane_setup_new.display_width = width;
+		plane_setup_new.display_height = height;
+
+		printf("Press enter to reconfigure to %ux%u %.4s ",
+		       plane_setup_new.buffer_width,
+		       plane_setup_new.buffer_height,
+		       (char *)&steps[i].format);
+		getchar();
+
+		start = time_us();
+
+		ret = drm_display_reconfigure(display, plane_setup,
+					      &plane_setup_new);
+		if (ret)
+			return ret;
+
+		printf("Reconfigured in %.2f ms, centre red %u\n",
+		       (double)(time_us() - start) / 1000,
+		       test_reconfigure_red(plane_setup->buffer_visible));
+
+		if (!test_reconfigure_red(plane_setup->buffer_visible)) {
+			fprintf(stderr, "Content was not carried over\n");
+			return 1;
+		}
+	}
+
+	return drm_display_teardown(display);
+}
+
+static int test_lease_lessee(int socket_fd)
+{
+	struct drm_display lessee = { 0 };
+	struct drm_display_buffer *buffer;
+	int fd;
+	int ret;
+
+	ret = drm_display_lease_receive(socket_fd, &fd);
+	if (ret)
+		return ret;
+
+	ret = drm_display_open_fd(&lessee, fd);
+	if (ret)
+		return ret;
+
+	/* Only the leased connector, CRTC and planes are visible here. */
+	lessee.primary_setup.buffer_format = DRM_FORMAT_XRGB8888;
+
+	ret = drm_display_probe(&lessee);
+	if (ret)
+		goto complete;
+
+	ret = drm_display_setup(&lessee);
+	if (ret)
+		goto complete;
+
+	buffer = drm_display_primary_buffer_cycle(&lessee);
+	if (!buffer) {
+		ret = 1;
+		goto complete;
+	}
+
+	drm_display_buffer_fill(buffer, NULL, 0x00339966);
+
+	ret = drm_display_configure(&lessee, &lessee.primary_setup, buffer);
+	if (ret)
+		goto complete;
+
+	printf("Lessee showing connector %u on CRTC %u\n",
+	       lessee.output.connector_id, lessee.output.crtc_id);
+
+	sleep(2);
+
+	ret = drm_display_teardown(&lessee);
+
+complete:
+	drm_display_close(&lessee);
+
+	return ret;
+}
+
+static int test_lease(struct drm_display *display)
+{
+	struct drm_display_lease lease;
+	int sockets[2] = { -1, -1 };
+	int status;
+	pid_t pid = -1;
+	int ret;
+
+	display->primary_setup.buffer_format = DRM_FORMAT_XRGB8888;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	ret = drm_display_lease_create(display, &lease);
+	if (ret) {
+		fprintf(stderr, "Failed to create lease: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	ret = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets);
+	if (ret) {
+		ret = 1;
+		goto complete;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		ret = 1;
+		goto complete;
+	}
+
+	if (!pid) {
+		close(sockets[0]);
+		ret = test_lease_lessee(sockets[1]);
+		_exit(ret ? 1 : 0);
+	}
+
+	close(sockets[1]);
+	sockets[1] = -1;
+
+	ret = drm_display_lease_send(&lease, sockets[0]);
+	if (ret) {
+		fprintf(stderr, "Failed to send lease: %s\n", strerror(-ret));
+		ret = 1;
+		goto complete;
+	}
+
+	close(sockets[0]);
+	sockets[0] = -1;
+
+	waitpid(pid, &status, 0);
+	pid = -1;
+
+	printf("Lessee %u exited with status %d\n", lease.lessee_id,
+	       WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		ret = 1;
+
+complete:
+	/* Closing our end makes a waiting lessee give up. */
+	if (sockets[0] >= 0)
+		close(sockets[0]);
+
+	if (sockets[1] >= 0)
+		close(sockets[1]);
+
+	if (pid > 0)
+		waitpid(pid, NULL, 0);
+
+	if (drm_display_lease_revoke(display, &lease))
+		ret = 1;
+
+	return ret;
+}
+
+static int test_scenario(struct drm_display *display)
+{
+	const char *roles[] = { "Primary", "Overlay", "Cursor" };
+	struct drm_display_scenario scenario;
+	struct drm_display_scenario_stats stats;
+	double duration;
+	unsigned int i;
+	int ret;
+
+	if (!test_argument) {
+		fprintf(stderr, "Usage: drm-display-test scenario <file>\n");
+		return 1;
+	}
+
+	ret = drm_display_scenario_load(&scenario, test_argument);
+	if (ret) {
+		if (scenario.error_line)
+			fprintf(stderr, "%s:%u: Invalid statement\n",
+				test_argument, scenario.error_line);
+		else
+			fprintf(stderr, "Failed to load %s: %s\n",
+				test_argument, strerror(-ret));
+		return 1;
+	}
+
+	ret = drm_display_scenario_run(&scenario, display, &stats);
+	if (ret) {
+		fprintf(stderr, "Failed to run scenario: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	duration = (double)stats.duration_us / 1000000;
+
+	for (i = 0; i < ARRAY_SIZE(roles); i++) {
+		if (!scenario.planes[i].used)
+			continue;
+
+		printf("%s plane: %.2f fps for %u requested, %u frames late\n",
+		       roles[i], stats.frames[i] / duration,
+		       scenario.planes[i].rate, stats.frames_late[i]);
+	}
+
+	printf("Commits: %u, %.2f ms average, %.2f ms max\n", stats.commits,
+	       stats.commits ? (double)stats.commit_us / stats.commits / 1000 :
+	       0.0, (double)stats.commit_us_max / 1000);
+
+	return 0;
+}
+
+static int test_record(struct drm_display *display)
+{
+	const char *path = test_argument ? test_argument : "drm-display.rec";
+	struct drm_display_recorder recorder;
+	struct drm_display_buffer *buffer;
+	unsigned int i;
+	int ret;
+
+	display->primary_setup.buffer_format = DRM_FORMAT_XRGB8888;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	ret = drm_display_setup(display);
+	if (ret)
+		return ret;
+
+	ret = drm_display_recorder_start(&recorder, display, path, 0);
+	if (ret) {
+		fprintf(stderr, "Failed to record to %s: %s\n", path,
+			strerror(-ret));
+		return 1;
+	}
+
+	buffer = drm_display_primary_buffer_cycle(display);
+	if (!buffer)
+		return 1;
+
+	drm_display_buffer_fill(buffer, NULL, 0x00336699);
+
+	ret = drm_display_configure(display, &display->primary_setup, buffer);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < 120; i++) {
+		buffer = drm_display_primary_buffer_cycle(display);
+		if (!buffer)
+			return 1;
+
+		drm_display_buffer_fill(buffer, NULL, 0x00010203 * i);
+
+		ret = drm_display_page_flip(display, &display->primary_setup,
+					    buffer);
+		if (ret)
+			return ret;
+	}
+
+	ret = drm_display_teardown(display);
+
+	printf("Recorded %u commits to %s, %u dropped\n",
+	       recorder.header->records_count, path,
+	       recorder.header->records_dropped);
+
+	drm_display_recorder_stop(&recorder);
+
+	return ret;
+}
+
+static int test_replay_run(struct drm_display *display, bool realtime)
+{
+	struct drm_display_replay_stats stats;
+	int ret;
+
+	if (!test_argument) {
+		fprintf(stderr, "Usage: drm-display-test replay <file>\n");
+		return 1;
+	}
+
+	display->primary_setup.buffer_format = DRM_FORMAT_XRGB8888;
+
+	ret = drm_display_probe(display);
+	if (ret)
+		return 1;
+
+	ret = drm_display_replay(display, test_argument, realtime, &stats);
+	if (ret) {
+		fprintf(stderr, "Failed to replay %s: %s\n", test_argument,
+			strerror(-ret));
+		return 1;
+	}
+
+	printf("Replayed %u commits in %.2f ms, %u failed, %u mismatched\n",
+	       stats.commits, (double)stats.duration_us / 1000,
+	       stats.commits_failed, stats.results_mismatched);
+	printf("Recorded: %.2f ms average, %.2f ms max\n",
+	       stats.commits ? (double)stats.recorded_us / stats.commits /
+	       1000 : 0.0, (double)stats.recorded_us_max / 1000);
+	printf("Replayed: %.2f ms average, %.2f ms max\n",
+	       stats.commits ? (double)stats.replayed_us / stats.commits /
+	       1000 : 0.0, (double)stats.replayed_us_max / 1000);
+
+	if (stats.properties_skipped)
+		printf("Skipped %u properties\n", stats.properties_skipped);
+
+	if (stats.commits_truncated)
+		printf("Log misses properties of %u commits\n",
+		       stats.commits_truncated);
+
+	if (stats.records_dropped)
+		printf("Log lost %u commits, state %s\n", stats.records_dropped,
+		       stats.state_restored ? "restored" : "not restored");
+
+	return 0;
+}
+
+static int test_replay(struct drm_display *display)
+{
+	return test_replay_run(display, true);
+}
+
+static int test_replay_max(struct drm_display *display)
+{
+	return test_replay_run(display, false);
+}
+
+static const struct {
+	const char *name;
+	int (*test)(struct drm_display *display);
+} tests[] = {
+	{ "color",	test_color },
+	{ "shadow",	test_shadow },
+	{ "presenter",	test_presenter },
+	{ "mailbox",	test_mailbox },
+	{ "hash",	test_hash },
+	{ "writeback",	test_writeback },
+	{ "pan",	test_pan },
+	{ "dynres",	test_dynamic_resolution },
+	{ "cursor",	test_cursor },
+	{ "lut",	test_lut },
+	{ "fbcache",	test_fb_cache },
+	{ "blend",	test_blend },
+	{ "rotate",	test_rotate },
+	{ "reconfigure", test_reconfigure },
+	{ "lease",	test_lease },
+	{ "scenario",	test_scenario },
+	{ "record",	test_record },
+	{ "replay",	test_replay },
+	{ "replay-max",	test_replay_max },
+};
+
+int main(int argc, char *argv[])
+{
+	struct drm_display display = { 0 };
+	const char *name = "color";
+	unsigned int i;
+	int ret;
+
+	if (argc > 1)
+		name = argv[1];
+
+	if (argc > 2)
+		test_argument = argv[2];
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++)
+		if (!strcmp(tests[i].name, name))
+			break;
+
+	if (i == ARRAY_SIZE(tests)) {
+		fprintf(stderr, "Unknown test: %s\n", name);
+		return 1;
+	}
+
 	ret = drm_display_open(&display);
 	if (ret)
 		return 1;
 
-	ret = test_color(&display);
+	ret = tests[i].test(&display);
 	if (ret)
 		return 1;
 
@@ -13,17 +13,255 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
 
+#include <linux/dma-buf.h>
+
+#include <cairo.h>
 #include <libudev.h>
 #include <drm_fourcc.h>
 #include <xf86drmMode.h>
 #include <xf86drm.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_acle.h>
+#endif
+
 #include <drm-display.h>
 
 #define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+#define DIV_ROUND_UP(value, divider) (((value) + (divider) - 1) / (divider))
+#define ALIGN(value, alignment) (DIV_ROUND_UP(value, alignment) * (alignment))
+
+#define HASH_BLOCK_ROWS		16
+#define HASH_THREADS_MAX	8
+
+/* Pixels per side of rotated tiles, so that both fit in L1 cache. */
+#define ROTATE_BLOCK		32
+
+struct drm_display_format {
+	uint32_t drm_format;
+	unsigned int planes;
+
+	/* Bytes per block, which covers hsub pixels on chroma planes. */
+	unsigned int cpp[4];
+	unsigned int hsub;
+	unsigned int vsub;
+
+	/* Width alignment in pixels. */
+	unsigned int align;
+
+	/* Meaningful bits of 32-bit pixels, excluding padding. */
+	uint32_t pixel_mask;
+
+	cairo_format_t cairo_format;
+
+	void (*pack)(uint8_t blocks[4][8], uint32_t color);
+};
+
+static void color_yuv(uint32_t color, uint8_t *y, uint8_t *u, uint8_t *v)
+{
+	int red = (color >> 16) & 0xff;
+	int green = (color >> 8) & 0xff;
+	int blue = color & 0xff;
+
+	/* BT.601 limited range. */
+	*y = ((66 * red + 129 * green + 25 * blue + 128) >> 8) + 16;
+	*u = ((-38 * red - 74 * green + 112 * blue + 128) >> 8) + 128;
+	*v = ((112 * red - 94 * green - 18 * blue + 128) >> 8) + 128;
+}
+
+static void pack_le16(uint8_t *block, uint16_t value)
+{
+	block[0] = value & 0xff;
+	block[1] = value >> 8;
+}
+
+static void pack_le32(uint8_t *block, uint32_t value)
+{
+	block[0] = value & 0xff;
+	block[1] = (value >> 8) & 0xff;
+	block[2] = (value >> 16) & 0xff;
+	block[3] = value >> 24;
+}
+
+static void format_pack_xrgb8888(uint8_t blocks[4][8], uint32_t color)
+{
+	pack_le32(blocks[0], color | 0xff000000);
+}
+
+static void format_pack_argb8888(uint8_t blocks[4][8], uint32_t color)
+{
+	pack_le32(blocks[0], color);
+}
+
+static void format_pack_rgb565(uint8_t blocks[4][8], uint32_t color)
+{
+	uint16_t value = ((color >> 8) & 0xf800) | ((color >> 5) & 0x07e0) |
+			 ((color >> 3) & 0x001f);
+
+	pack_le16(blocks[0], value);
+}
+
+static void format_pack_xrgb2101010(uint8_t blocks[4][8], uint32_t color)
+{
+	uint32_t red = (color >> 16) & 0xff;
+	uint32_t green = (color >> 8) & 0xff;
+	uint32_t blue = color & 0xff;
+	uint32_t value;
+
+	/* Replicate the most significant bits to cover the full range. */
+	value = (0x3 << 30) | ((red << 2 | red >> 6) << 20) |
+		((green << 2 | green >> 6) << 10) | (blue << 2 | blue >> 6);
+
+	pack_le32(blocks[0], value);
+}
+
+static void format_pack_nv12(uint8_t blocks[4][8], uint32_t color)
+{
+	color_yuv(color, &blocks[0][0], &blocks[1][0], &blocks[1][1]);
+}
+
+static void format_pack_nv21(uint8_t blocks[4][8], uint32_t color)
+{
+	color_yuv(color, &blocks[0][0], &blocks[1][1], &blocks[1][0]);
+}
+
+static void format_pack_yuv420(uint8_t blocks[4][8], uint32_t color)
+{
+	color_yuv(color, &blocks[0][0], &blocks[1][0], &blocks[2][0]);
+}
+
+static void format_pack_p010(uint8_t blocks[4][8], uint32_t color)
+{
+	uint8_t y, u, v;
+
+	/* Samples are stored in the 10 most significant bits. */
+	color_yuv(color, &y, &u, &v);
+
+	pack_le16(&blocks[0][0], y << 8);
+	pack_le16(&blocks[1][0], u << 8);
+	pack_le16(&blocks[1][2], v << 8);
+}
+
+static const struct drm_display_format formats[] = {
+	{
+		.drm_format	= DRM_FORMAT_XRGB8888,
+		.planes		= 1,
+		.cpp		= { 4 },
+		.hsub		= 1,
+		.vsub		= 1,
+		.align		= 1,
+		.pixel_mask	= 0x00ffffff,
+		.cairo_format	= CAIRO_FORMAT_RGB24,
+		.pack		= format_pack_xrgb8888,
+	},
+	{
+		.drm_format	= DRM_FORMAT_ARGB8888,
+		.planes		= 1,
+		.cpp		= { 4 },
+		.hsub		= 1,
+		.vsub		= 1,
+		.align		= 1,
+		.cairo_format	= CAIRO_FORMAT_ARGB32,
+		.pack		= format_pack_argb8888,
+	},
+	{
+		.drm_format	= DRM_FORMAT_RGB565,
+		.planes		= 1,
+		.cpp		= { 2 },
+		.hsub		= 1,
+		.vsub		= 1,
+		.align		= 2,
+		.cairo_format	= CAIRO_FORMAT_RGB16_565,
+		.pack		= format_pack_rgb565,
+	},
+	{
+		.drm_format	= DRM_FORMAT_XRGB2101010,
+		.planes		= 1,
+		.cpp		= { 4 },
+		.hsub		= 1,
+		.vsub		= 1,
+		.align		= 1,
+		.pixel_mask	= 0x3fffffff,
+		.cairo_format	= CAIRO_FORMAT_RGB30,
+		.pack		= format_pack_xrgb2101010,
+	},
+	{
+		.drm_format	= DRM_FORMAT_NV12,
+		.planes		= 2,
+		.cpp		= { 1, 2 },
+		.hsub		= 2,
+		.vsub		= 2,
+		.align		= 2,
+		.cairo_format	= CAIRO_FORMAT_INVALID,
+		.pack		= format_pack_nv12,
+	},
+	{
+		.drm_format	= DRM_FORMAT_NV21,
+		.planes		= 2,
+		.cpp		= { 1, 2 },
+		.hsub		= 2,
+		.vsub		= 2,
+		.align		= 2,
+		.cairo_format	= CAIRO_FORMAT_INVALID,
+		.pack		= format_pack_nv21,
+	},
+	{
+		.drm_format	= DRM_FORMAT_NV16,
+		.planes		= 2,
+		.cpp		= { 1, 2 },
+		.hsub		= 2,
+		.vsub		= 1,
+		.align		= 2,
+		.cairo_format	= CAIRO_FORMAT_INVALID,
+		.pack		= format_pack_nv12,
+	},
+	{
+		.drm_format	= DRM_FORMAT_YUV420,
+		.planes		= 3,
+		.cpp		= { 1, 1, 1 },
+		.hsub		= 2,
+		.vsub		= 2,
+		.align		= 2,
+		.cairo_format	= CAIRO_FORMAT_INVALID,
+		.pack		= format_pack_yuv420,
+	},
+	{
+		.drm_format	= DRM_FORMAT_P010,
+		.planes		= 2,
+		.cpp		= { 2, 4 },
+		.hsub		= 2,
+		.vsub		= 2,
+		.align		= 2,
+		.cairo_format	= CAIRO_FORMAT_INVALID,
+		.pack		= format_pack_p010,
+	},
+};
+
+static const struct drm_display_format *format_find(uint32_t drm_format)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(formats); i++)
+		if (formats[i].drm_format == drm_format)
+			return &formats[i];
+
+	return NULL;
+}
 
 struct drm_display_buffer *drm_display_primary_buffer_cycle(struct drm_display *display)
 {
@@ -67,311 +305,2962 @@ struct drm_display_buffer *drm_display_overlay_buffer_cycle(struct drm_display *
 	return buffer;
 }
 
-int drm_display_buffer_dma_buf_export(struct drm_display *display,
-				      struct drm_display_buffer *buffer,
-				      int *fd)
+void drm_display_buffer_damage(struct drm_display_buffer *buffer,
+				unsigned int x, unsigned int y,
+				unsigned int width, unsigned int height)
 {
-	int ret;
+	struct drm_display_rect *damage;
+	unsigned int x_end, y_end;
 
-	if (!display || !buffer || !fd)
-		return -EINVAL;
+	if (!buffer || x >= buffer->width || y >= buffer->height)
+		return;
 
-	ret = drmPrimeHandleToFD(display->drm_fd, buffer->handles[0], 0, fd);
-	if (ret)
-		return -errno;
+	damage = &buffer->damage;
 
-	return 0;
+	x_end = x + width;
+	if (x_end > buffer->width)
+		x_end = buffer->width;
+
+	y_end = y + height;
+	if (y_end > buffer->height)
+		y_end = buffer->height;
+
+	if (x_end == x || y_end == y)
+		return;
+
+	if (buffer->damage_set && damage->width && damage->height) {
+		if ((damage->x + damage->width) > x_end)
+			x_end = damage->x + damage->width;
+		if ((damage->y + damage->height) > y_end)
+			y_end = damage->y + damage->height;
+		if (damage->x < x)
+			x = damage->x;
+		if (damage->y < y)
+			y = damage->y;
+	}
+
+	damage->x = x;
+	damage->y = y;
+	damage->width = x_end - x;
+	damage->height = y_end - y;
+
+	buffer->damage_set = true;
+	buffer->hash_clean = false;
 }
 
-int drm_display_buffer_setup(struct drm_display *display,
-			     struct drm_display_buffer *buffer,
-			     struct drm_display_plane_setup *plane_setup)
+void drm_display_buffer_damage_clear(struct drm_display_buffer *buffer)
 {
-	struct drm_mode_create_dumb create_dumb = { 0 };
-	struct drm_mode_map_dumb map_dumb = { 0 };
-	int ret;
-
-	if (!display || !buffer || !plane_setup)
-		return -EINVAL;
+	if (!buffer)
+		return;
 
-	buffer->width = plane_setup->buffer_width;
-	buffer->height = plane_setup->buffer_height;
-	buffer->format = plane_setup->buffer_format;
+	memset(&buffer->damage, 0, sizeof(buffer->damage));
+	buffer->damage_set = true;
+}
 
-	switch (buffer->format) {
-	case DRM_FORMAT_XRGB8888:
-	case DRM_FORMAT_ARGB8888:
-		create_dumb.width = buffer->width;
-		create_dumb.height = buffer->height;
-		create_dumb.bpp = 32;
-		break;
-	case DRM_FORMAT_NV12:
-	case DRM_FORMAT_YUV420:
-		create_dumb.width = buffer->width;
-		/* cdw * cdh * 32 / 8 = bw * bh * 3 / 2 */
-		create_dumb.height = (buffer->height * 3 + 7) / 8;
-		create_dumb.bpp = 32;
-		break;
-	default:
-		return -EINVAL;
-	}
+void drm_display_buffer_damage_full(struct drm_display_buffer *buffer)
+{
+	if (!buffer)
+		return;
 
-	ret = drmIoctl(display->drm_fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_dumb);
-	if (ret)
-		return -errno;
+	/* Content changed behind our back, nothing previous can be kept. */
+	buffer->damage_set = false;
+	buffer->hash_valid = false;
+	buffer->hash_clean = false;
+}
 
-	buffer->handles[0] = create_dumb.handle;
-	buffer->strides[0] = create_dumb.pitch;
-	buffer->sizes[0] = create_dumb.size;
+cairo_t *drm_display_buffer_cairo(struct drm_display_buffer *buffer)
+{
+	struct drm_display_rect *damage;
+	cairo_t *cairo;
 
-	map_dumb.handle = buffer->handles[0];
+	if (!buffer || !buffer->cairo)
+		return NULL;
 
-	ret = drmIoctl(display->drm_fd, DRM_IOCTL_MODE_MAP_DUMB, &map_dumb);
-	if (ret)
-		goto error;
+	cairo = buffer->cairo;
+	damage = &buffer->damage;
 
-	buffer->data[0] = mmap(0, buffer->sizes[0], PROT_READ | PROT_WRITE,
-			       MAP_SHARED, display->drm_fd, map_dumb.offset);
-	if (buffer->data[0] == MAP_FAILED)
-		goto error;
+	cairo_reset_clip(cairo);
 
-	switch (buffer->format) {
-	case DRM_FORMAT_NV12:
-		buffer->strides[0] /= 4;
-		buffer->handles[1] = buffer->handles[0];
-		buffer->offsets[1] = buffer->width * buffer->height;
-		buffer->data[1] = buffer->data[0] + buffer->offsets[1];
-		buffer->strides[1] = buffer->strides[0];
-		break;
-	case DRM_FORMAT_YUV420:
-		buffer->strides[0] /= 4;
-		buffer->handles[1] = buffer->handles[0];
-		buffer->handles[2] = buffer->handles[0];
-		buffer->offsets[1] = buffer->width * buffer->height;
-		buffer->offsets[2] = buffer->offsets[1] + buffer->offsets[1] / 4;
-		buffer->data[1] = buffer->data[0] + buffer->offsets[1];
-		buffer->data[2] = buffer->data[1] + buffer->offsets[2];
-		buffer->strides[1] = buffer->strides[0];
-		buffer->strides[2] = buffer->strides[1];
-		break;
+	/* Only rasterise what changed when damage was reported. */
+	if (buffer->damage_set) {
+		cairo_rectangle(cairo, damage->x, damage->y, damage->width,
+				damage->height);
+		cairo_clip(cairo);
 	}
 
-	ret = drmModeAddFB2(display->drm_fd, buffer->width, buffer->height,
-			    buffer->format, buffer->handles, buffer->strides,
-			    buffer->offsets, &buffer->fb_id, 0);
-	if (ret)
+	return cairo;
+}
+
+static int buffer_cairo_setup(struct drm_display_buffer *buffer)
+{
+	const struct drm_display_format *format;
+	cairo_format_t cairo_format;
+
+	format = format_find(buffer->format);
+	if (!format || format->cairo_format == CAIRO_FORMAT_INVALID)
+		return 0;
+
+	cairo_format = format->cairo_format;
+
+	buffer->cairo_surface =
+		cairo_image_surface_create_for_data(buffer->data[0],
+						    cairo_format,
+						    buffer->width,
+						    buffer->height,
+						    buffer->strides[0]);
+	if (cairo_surface_status(buffer->cairo_surface) != CAIRO_STATUS_SUCCESS)
+		goto error;
+
+	buffer->cairo = cairo_create(buffer->cairo_surface);
+	if (cairo_status(buffer->cairo) != CAIRO_STATUS_SUCCESS)
 		goto error;
 
 	return 0;
 
 error:
-	if (create_dumb.handle) {
-		struct drm_mode_destroy_dumb destroy_dumb = { 0 };
+	if (buffer->cairo) {
+		cairo_destroy(buffer->cairo);
+		buffer->cairo = NULL;
+	}
 
-		destroy_dumb.handle = buffer->handles[0];
+	cairo_surface_destroy(buffer->cairo_surface);
+	buffer->cairo_surface = NULL;
 
-		drmIoctl(display->drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB,
-			 &destroy_dumb);
+	return -1;
+}
+
+static void buffer_cairo_teardown(struct drm_display_buffer *buffer)
+{
+	if (buffer->cairo)
+		cairo_destroy(buffer->cairo);
+
+	if (buffer->cairo_surface)
+		cairo_surface_destroy(buffer->cairo_surface);
+
+	buffer->cairo = NULL;
+	buffer->cairo_surface = NULL;
+}
+
+static void copy_stream(void *destination, const void *source, size_t size)
+{
+#ifdef __SSE2__
+	uint8_t *destination_bytes = destination;
+	const uint8_t *source_bytes = source;
+	size_t head;
+
+	/* Non-temporal stores avoid reading back write-combined memory. */
+	head = (16 - ((uintptr_t)destination_bytes & 15)) & 15;
+	if (head > size)
+		head = size;
+
+	memcpy(destination_bytes, source_bytes, head);
+	destination_bytes += head;
+	source_bytes += head;
+	size -= head;
+
+	while (size >= 64) {
+		__m128i *vector_destination = (__m128i *)destination_bytes;
+		const __m128i *vector_source = (const __m128i *)source_bytes;
+		__m128i v0, v1, v2, v3;
+
+		v0 = _mm_loadu_si128(vector_source);
+		v1 = _mm_loadu_si128(vector_source + 1);
+		v2 = _mm_loadu_si128(vector_source + 2);
+		v3 = _mm_loadu_si128(vector_source + 3);
+
+		_mm_stream_si128(vector_destination, v0);
+		_mm_stream_si128(vector_destination + 1, v1);
+		_mm_stream_si128(vector_destination + 2, v2);
+		_mm_stream_si128(vector_destination + 3, v3);
+
+		destination_bytes += 64;
+		source_bytes += 64;
+		size -= 64;
 	}
 
-	if (buffer->data[0] && buffer->data[0] != MAP_FAILED)
-		munmap(buffer->data[0], buffer->sizes[0]);
+	while (size >= 16) {
+		_mm_stream_si128((__m128i *)destination_bytes,
+				 _mm_loadu_si128((const __m128i *)source_bytes));
 
-	memset(buffer, 0, sizeof(*buffer));
+		destination_bytes += 16;
+		source_bytes += 16;
+		size -= 16;
+	}
 
-	return -1;
+	memcpy(destination_bytes, source_bytes, size);
+
+	_mm_sfence();
+#else
+	memcpy(destination, source, size);
+#endif
 }
 
-int drm_display_buffer_teardown(struct drm_display *display,
-				struct drm_display_buffer *buffer)
+static void buffer_shadow_copy(struct drm_display_buffer *buffer)
 {
-	struct drm_mode_destroy_dumb destroy_dumb = { 0 };
+	const struct drm_display_format *format;
+	unsigned int y_start = 0;
+	unsigned int y_end = buffer->height;
+	unsigned int i;
 
-	if (!display || !buffer)
-		return -EINVAL;
+	if (!buffer->shadow)
+		return;
 
-	drmModeRmFB(display->drm_fd, buffer->fb_id);
+	format = format_find(buffer->format);
+	if (!format)
+		return;
 
-	if (buffer->data[0])
-		munmap(buffer->data[0], buffer->sizes[0]);
+	if (buffer->damage_set) {
+		y_start = buffer->damage.y;
+		y_end = buffer->damage.y + buffer->damage.height;
+	}
 
-	destroy_dumb.handle = buffer->handles[0];
-	drmIoctl(display->drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_dumb);
+	if (y_start >= y_end)
+		return;
 
-	memset(buffer, 0, sizeof(*buffer));
+	/* Damaged rows are contiguous in each plane. */
+	for (i = 0; i < format->planes; i++) {
+		unsigned int vsub = i ? format->vsub : 1;
+		unsigned int rows_start = y_start / vsub;
+		unsigned int rows_end = DIV_ROUND_UP(y_end, vsub);
+		size_t offset;
 
-	return 0;
+		offset = buffer->offsets[i] + rows_start * buffer->strides[i];
+
+		copy_stream(buffer->map + offset, buffer->shadow + offset,
+			    (rows_end - rows_start) * buffer->strides[i]);
+	}
 }
 
-int drm_display_detach(struct drm_display *display,
-		       struct drm_display_plane_setup *plane_setup)
+static void buffer_damage_reset(struct drm_display_buffer *buffer)
 {
-	drmModeAtomicReqPtr request;
-	struct drm_display_plane_properties *plane_properties;
-	uint32_t flags = 0;
-	uint32_t plane_id;
-	int ret;
+	/* Damage that was never hashed is lost from now on. */
+	if (!buffer->hash_clean)
+		buffer->hash_valid = false;
 
-	if (!display || !plane_setup)
+	buffer->damage_set = false;
+}
+
+static bool buffer_undamaged(struct drm_display_buffer *buffer)
+{
+	return buffer->damage_set &&
+	       (!buffer->damage.width || !buffer->damage.height);
+}
+
+static void buffer_commit_prepare(struct drm_display_buffer *buffer)
+{
+	if (buffer->cairo_surface)
+		cairo_surface_flush(buffer->cairo_surface);
+
+	buffer_shadow_copy(buffer);
+}
+
+int drm_display_buffer_fill(struct drm_display_buffer *buffer,
+			    const struct drm_display_rect *rect,
+			    uint32_t color)
+{
+	const struct drm_display_format *format;
+	struct drm_display_rect area = { 0 };
+	uint8_t blocks[4][8] = { 0 };
+	uint8_t *line;
+	unsigned int i;
+
+	if (!buffer)
 		return -EINVAL;
 
-	if (!plane_setup->configured)
-		return -1;
+	/* Device and export buffers have to be mapped for CPU access. */
+	if (!buffer->data[0])
+		return -EACCES;
 
-	plane_properties = &plane_setup->plane.properties;
-	plane_id = plane_setup->plane.id;
+	format = format_find(buffer->format);
+	if (!format)
+		return -EINVAL;
 
-	request = drmModeAtomicAlloc();
-	if (!request)
+	if (rect) {
+		area = *rect;
+
+		if (area.x >= buffer->width || area.y >= buffer->height)
+			return 0;
+
+		if (area.width > buffer->width - area.x)
+			area.width = buffer->width - area.x;
+		if (area.height > buffer->height - area.y)
+			area.height = buffer->height - area.y;
+	} else {
+		area.width = buffer->width;
+		area.height = buffer->height;
+	}
+
+	format->pack(blocks, color);
+
+	line = malloc(buffer->strides[0]);
+	if (!line)
 		return -ENOMEM;
 
-	drmModeAtomicAddProperty(request, plane_id, plane_properties->fb_id, 0);
-	drmModeAtomicAddProperty(request, plane_id, plane_properties->crtc_id,
-				 0);
+	for (i = 0; i < format->planes; i++) {
+		unsigned int hsub = i ? format->hsub : 1;
+		unsigned int vsub = i ? format->vsub : 1;
+		unsigned int cpp = format->cpp[i];
+		unsigned int x_start = area.x / hsub;
+		unsigned int x_end = DIV_ROUND_UP(area.x + area.width, hsub);
+		unsigned int y_start = area.y / vsub;
+		unsigned int y_end = DIV_ROUND_UP(area.y + area.height, vsub);
+		unsigned int size = (x_end - x_start) * cpp;
+		unsigned int x, y;
+
+		if (!buffer->data[i])
+			break;
 
-	ret = drmModeAtomicCommit(display->drm_fd, request, flags, NULL);
-	if (ret) {
-		ret = -errno;
-		goto complete;
+		/* Build the line once in cached memory and copy it out. */
+		for (x = 0; x < (x_end - x_start); x++)
+			memcpy(line + x * cpp, blocks[i], cpp);
+
+		for (y = y_start; y < y_end; y++)
+			memcpy(buffer->data[i] + y * buffer->strides[i] +
+			       x_start * cpp, line, size);
 	}
 
-	plane_setup->buffer_visible = NULL;
-	plane_setup->configured = false;
+	free(line);
 
-complete:
-	drmModeAtomicFree(request);
+	return 0;
+}
 
-	return ret;
+static void rotate_pixel(const struct drm_display_buffer *source,
+			 struct drm_display_buffer *destination,
+			 uint32_t rotation, unsigned int x, unsigned int y)
+{
+	const uint32_t *pixel = source->data[0] + y * source->strides[0] +
+				x * 4;
+	unsigned int x_rotated, y_rotated;
+
+	/* Rotations are counter-clockwise, as for the plane property. */
+	switch (rotation) {
+	case DRM_MODE_ROTATE_90:
+		x_rotated = y;
+		y_rotated = source->width - 1 - x;
+		break;
+	case DRM_MODE_ROTATE_180:
+		x_rotated = source->width - 1 - x;
+		y_rotated = source->height - 1 - y;
+		break;
+	case DRM_MODE_ROTATE_270:
+		x_rotated = source->height - 1 - y;
+		y_rotated = x;
+		break;
+	default:
+		x_rotated = x;
+		y_rotated = y;
+		break;
+	}
+
+	*(uint32_t *)(destination->data[0] +
+		      y_rotated * destination->strides[0] + x_rotated * 4) =
+		*pixel;
 }
 
-int drm_display_page_flip(struct drm_display *display,
-			  struct drm_display_plane_setup *plane_setup,
-			  struct drm_display_buffer *buffer)
+#ifdef __SSE2__
+static void rotate_quad(const struct drm_display_buffer *source,
+			struct drm_display_buffer *destination,
+			uint32_t rotation, unsigned int x, unsigned int y)
 {
-	drmModeAtomicReqPtr request;
-	struct drm_display_plane_properties *plane_properties;
-	uint32_t flags = 0;
-	uint32_t plane_id;
-	int ret;
+	const uint8_t *data = source->data[0] + y * source->strides[0] + x * 4;
+	unsigned int stride = source->strides[0];
+	__m128i rows[4], low[2], high[2], columns[4];
+	uint8_t *line;
+	unsigned int i;
 
-	if (!display || !buffer || !plane_setup)
+	for (i = 0; i < 4; i++)
+		rows[i] = _mm_loadu_si128((const __m128i *)(data + i * stride));
+
+	/* Transpose so that each register holds a source column. */
+	low[0] = _mm_unpacklo_epi32(rows[0], rows[1]);
+	low[1] = _mm_unpacklo_epi32(rows[2], rows[3]);
+	high[0] = _mm_unpackhi_epi32(rows[0], rows[1]);
+	high[1] = _mm_unpackhi_epi32(rows[2], rows[3]);
+
+	columns[0] = _mm_unpacklo_epi64(low[0], low[1]);
+	columns[1] = _mm_unpackhi_epi64(low[0], low[1]);
+	columns[2] = _mm_unpacklo_epi64(high[0], high[1]);
+	columns[3] = _mm_unpackhi_epi64(high[0], high[1]);
+
+	for (i = 0; i < 4; i++) {
+		unsigned int x_rotated, y_rotated;
+		__m128i column = columns[i];
+
+		if (rotation == DRM_MODE_ROTATE_90) {
+			x_rotated = y;
+			y_rotated = source->width - 1 - (x + i);
+		} else {
+			/* Rows end up right to left, reverse the pixels. */
+			column = _mm_shuffle_epi32(column, 0x1b);
+			x_rotated = source->height - 4 - y;
+			y_rotated = x + i;
+		}
+
+		line = (uint8_t *)destination->data[0] +
+		       y_rotated * destination->strides[0];
+
+		_mm_storeu_si128((__m128i *)(line + x_rotated * 4), column);
+	}
+}
+#endif
+
+static void rotate_tile(const struct drm_display_buffer *source,
+			struct drm_display_buffer *destination,
+			uint32_t rotation, unsigned int x_start,
+			unsigned int y_start, unsigned int x_end,
+			unsigned int y_end)
+{
+	unsigned int x, y;
+
+#ifdef __SSE2__
+	if (rotation == DRM_MODE_ROTATE_90 || rotation == DRM_MODE_ROTATE_270) {
+		unsigned int x_quads = x_start + (x_end - x_start) / 4 * 4;
+		unsigned int y_quads = y_start + (y_end - y_start) / 4 * 4;
+
+		for (y = y_start; y < y_quads; y += 4)
+			for (x = x_start; x < x_quads; x += 4)
+				rotate_quad(source, destination, rotation, x,
+					    y);
+
+		/* Handle the remaining edges one pixel at a time. */
+		for (y = y_start; y < y_end; y++)
+			for (x = y < y_quads ? x_quads : x_start; x < x_end;
+			     x++)
+				rotate_pixel(source, destination, rotation, x,
+					     y);
+
+		return;
+	}
+#endif
+
+	for (y = y_start; y < y_end; y++)
+		for (x = x_start; x < x_end; x++)
+			rotate_pixel(source, destination, rotation, x, y);
+}
+
+int drm_display_buffer_rotate(struct drm_display_buffer *destination,
+			      const struct drm_display_buffer *source,
+			      uint32_t rotation)
+{
+	const struct drm_display_format *format;
+	unsigned int width, height;
+	unsigned int x, y;
+
+	if (!destination || !source || !destination->data[0] ||
+	    !source->data[0] || destination->format != source->format)
 		return -EINVAL;
 
-	if (!plane_setup->configured)
-		return -1;
+	/* Only rotations of single-plane 32-bit formats are handled. */
+	format = format_find(source->format);
+	if (!format || format->planes != 1 || format->cpp[0] != 4 ||
+	    rotation & ~DRM_MODE_ROTATE_MASK)
+		return -EOPNOTSUPP;
 
-	plane_properties = &plane_setup->plane.properties;
-	plane_id = plane_setup->plane.id;
+	if (rotation == DRM_MODE_ROTATE_90 || rotation == DRM_MODE_ROTATE_270) {
+		width = source->height;
+		height = source->width;
+	} else {
+		width = source->width;
+		height = source->height;
+	}
 
-	request = drmModeAtomicAlloc();
-	if (!request)
-		return -ENOMEM;
+	if (destination->width != width || destination->height != height)
+		return -EINVAL;
 
-	drmModeAtomicAddProperty(request, plane_id, plane_properties->fb_id,
-				 buffer->fb_id);
-	drmModeAtomicAddProperty(request, plane_id, plane_properties->crtc_id,
-				 display->output.crtc_id);
+	if (rotation == DRM_MODE_ROTATE_0 || !rotation) {
+		for (y = 0; y < height; y++)
+			memcpy((uint8_t *)destination->data[0] +
+			       y * destination->strides[0],
+			       (const uint8_t *)source->data[0] +
+			       y * source->strides[0], width * 4);
 
-	ret = drmModeAtomicCommit(display->drm_fd, request, flags, NULL);
-	if (ret) {
-		ret = -errno;
-		goto complete;
+		return 0;
 	}
 
-	plane_setup->buffer_visible = buffer;
+	/* Walk tiles so that destination lines stay cached across rows. */
+	for (y = 0; y < source->height; y += ROTATE_BLOCK) {
+		unsigned int y_end = y + ROTATE_BLOCK;
+
+		if (y_end > source->height)
+			y_end = source->height;
+
+		for (x = 0; x < source->width; x += ROTATE_BLOCK) {
+			unsigned int x_end = x + ROTATE_BLOCK;
+
+			if (x_end > source->width)
+				x_end = source->width;
+
+			rotate_tile(source, destination, rotation, x, y, x_end,
+				    y_end);
+		}
+	}
+
+	return 0;
+}
+
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Rows are hashed 8 bytes at a time with mask applied, the trailing bytes
+ * use its low bytes in order. Padding bits are cleared that way so that
+ * they do not affect the hash.
+ */
+static uint32_t (*crc32c_row)(uint32_t crc, const uint8_t *data, size_t size,
+			      uint64_t mask);
+
+static uint32_t crc32c_row_table(uint32_t crc, const uint8_t *data,
+				 size_t size, uint64_t mask)
+{
+	uint64_t value;
+	unsigned int i;
+
+	while (size >= 8) {
+		memcpy(&value, data, sizeof(value));
+		value &= mask;
+
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 8) ^
+			      crc32c_table[(crc ^ (value >> (i * 8))) & 0xff];
+
+		data += 8;
+		size -= 8;
+	}
+
+	for (i = 0; i < size; i++) {
+		uint8_t byte = data[i] & (mask >> (i * 8));
+
+		crc = (crc >> 8) ^ crc32c_table[(crc ^ byte) & 0xff];
+	}
+
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_row_sse42(uint32_t crc, const uint8_t *data,
+				 size_t size, uint64_t mask)
+{
+	uint64_t value;
+	unsigned int i;
+
+	while (size >= 8) {
+		memcpy(&value, data, sizeof(value));
+		crc = _mm_crc32_u64(crc, value & mask);
+
+		data += 8;
+		size -= 8;
+	}
+
+	for (i = 0; i < size; i++)
+		crc = _mm_crc32_u8(crc, data[i] & (mask >> (i * 8)));
+
+	return crc;
+}
+#elif defined(__aarch64__)
+__attribute__((target("+crc")))
+static uint32_t crc32c_row_crc(uint32_t crc, const uint8_t *data,
+			       size_t size, uint64_t mask)
+{
+	uint64_t value;
+	unsigned int i;
+
+	while (size >= 8) {
+		memcpy(&value, data, sizeof(value));
+		crc = __crc32cd(crc, value & mask);
+
+		data += 8;
+		size -= 8;
+	}
+
+	for (i = 0; i < size; i++)
+		crc = __crc32cb(crc, data[i] & (mask >> (i * 8)));
+
+	return crc;
+}
+#endif
+
+static void crc32c_init(void)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(crc32c_table); i++) {
+		uint32_t crc = i;
+
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+
+		crc32c_table[i] = crc;
+	}
+
+	/* Hardware instructions are picked at runtime, not build time. */
+	crc32c_row = crc32c_row_table;
+
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2"))
+		crc32c_row = crc32c_row_sse42;
+#elif defined(__aarch64__)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+		crc32c_row = crc32c_row_crc;
+#endif
+}
+
+struct hash_job {
+	struct drm_display_buffer *buffer;
+	const struct drm_display_format *format;
+	unsigned int block_start;
+	unsigned int block_end;
+};
+
+static uint32_t hash_block(struct drm_display_buffer *buffer,
+			   const struct drm_display_format *format,
+			   unsigned int block)
+{
+	uint64_t mask = ~0ULL;
+	uint32_t crc = ~0U;
+	unsigned int i;
+
+	if (format->pixel_mask)
+		mask = (uint64_t)format->pixel_mask << 32 | format->pixel_mask;
+
+	for (i = 0; i < format->planes; i++) {
+		unsigned int hsub = i ? format->hsub : 1;
+		unsigned int vsub = i ? format->vsub : 1;
+		unsigned int y_start = block * HASH_BLOCK_ROWS / vsub;
+		unsigned int y_end = (block + 1) * HASH_BLOCK_ROWS;
+		unsigned int size;
+		unsigned int y;
+
+		if (y_end > buffer->height)
+			y_end = buffer->height;
+
+		y_end = DIV_ROUND_UP(y_end, vsub);
+		size = DIV_ROUND_UP(buffer->width, hsub) * format->cpp[i];
+
+		/* Only visible pixels are hashed, not the stride padding. */
+		for (y = y_start; y < y_end; y++)
+			crc = crc32c_row(crc, buffer->data[i] +
+					 y * buffer->strides[i], size, mask);
+	}
+
+	return ~crc;
+}
+
+static void *hash_job_run(void *data)
+{
+	struct hash_job *job = data;
+	unsigned int block;
+
+	for (block = job->block_start; block < job->block_end; block++)
+		job->buffer->hash_blocks[block] =
+			hash_block(job->buffer, job->format, block);
+
+	return NULL;
+}
+
+static void hash_blocks_run(struct drm_display_buffer *buffer,
+			    const struct drm_display_format *format,
+			    unsigned int block_start, unsigned int block_end)
+{
+	struct hash_job jobs[HASH_THREADS_MAX];
+	pthread_t threads[HASH_THREADS_MAX];
+	bool spawned[HASH_THREADS_MAX] = { 0 };
+	unsigned int blocks = block_end - block_start;
+	unsigned int count;
+	long processors;
+	unsigned int i;
+
+	processors = sysconf(_SC_NPROCESSORS_ONLN);
+	count = processors > 0 ? processors : 1;
+
+	if (count > HASH_THREADS_MAX)
+		count = HASH_THREADS_MAX;
+
+	/* Threads are only worth it for larger regions. */
+	if (count > blocks / 8)
+		count = blocks / 8;
+
+	if (count < 1)
+		count = 1;
+
+	for (i = 0; i < count; i++) {
+		jobs[i].buffer = buffer;
+		jobs[i].format = format;
+		jobs[i].block_start = block_start + blocks * i / count;
+		jobs[i].block_end = block_start + blocks * (i + 1) / count;
+
+		if (i > 0)
+			spawned[i] = !pthread_create(&threads[i], NULL,
+						     hash_job_run, &jobs[i]);
+	}
+
+	/* The first job and any that failed to spawn run here. */
+	for (i = 0; i < count; i++)
+		if (!spawned[i])
+			hash_job_run(&jobs[i]);
+
+	for (i = 0; i < count; i++)
+		if (spawned[i])
+			pthread_join(threads[i], NULL);
+}
+
+int drm_display_buffer_hash(struct drm_display_buffer *buffer,
+			    uint32_t *hash)
+{
+	const struct drm_display_format *format;
+	unsigned int blocks_count;
+	unsigned int block_start = 0;
+	unsigned int block_end;
+	uint32_t crc = ~0U;
+
+	if (!buffer || !hash)
+		return -EINVAL;
+
+	if (!buffer->data[0])
+		return -EACCES;
+
+	format = format_find(buffer->format);
+	if (!format)
+		return -EINVAL;
+
+	pthread_once(&crc32c_once, crc32c_init);
+
+	blocks_count = DIV_ROUND_UP(buffer->height, HASH_BLOCK_ROWS);
+
+	if (buffer->hash_blocks_count != blocks_count) {
+		free(buffer->hash_blocks);
+
+		buffer->hash_blocks = calloc(blocks_count,
+					     sizeof(*buffer->hash_blocks));
+		if (!buffer->hash_blocks) {
+			buffer->hash_blocks_count = 0;
+			return -ENOMEM;
+		}
+
+		buffer->hash_blocks_count = blocks_count;
+		buffer->hash_valid = false;
+	}
+
+	block_end = blocks_count;
+
+	/* Only rehash the blocks covered by damage when possible. */
+	if (buffer->hash_valid && buffer->damage_set) {
+		block_start = buffer->damage.y / HASH_BLOCK_ROWS;
+		block_end = DIV_ROUND_UP(buffer->damage.y +
+					 buffer->damage.height,
+					 HASH_BLOCK_ROWS);
+	}
+
+	if (block_start < block_end)
+		hash_blocks_run(buffer, format, block_start, block_end);
+
+	crc = crc32c_row(crc, (const uint8_t *)buffer->hash_blocks,
+			 blocks_count * sizeof(*buffer->hash_blocks), ~0ULL);
+
+	buffer->hash_valid = true;
+	buffer->hash_clean = true;
+
+	*hash = ~crc;
+
+	return 0;
+}
+
+int drm_display_buffer_dma_buf_export(struct drm_display *display,
+				      struct drm_display_buffer *buffer,
+				      int *fd)
+{
+	int ret;
+
+	if (!display || !buffer || !fd)
+		return -EINVAL;
+
+	ret = drmPrimeHandleToFD(display->drm_fd, buffer->handles[0], 0, fd);
+	if (ret)
+		return -errno;
+
+	/* Keep a reference to bracket CPU access with cache maintenance. */
+	if (buffer->dma_buf_fd < 0)
+		buffer->dma_buf_fd = fcntl(*fd, F_DUPFD_CLOEXEC, 0);
+
+	return 0;
+}
+
+static void buffer_data_setup(struct drm_display_buffer *buffer, void *base)
+{
+	const struct drm_display_format *format;
+	unsigned int i;
+
+	format = format_find(buffer->format);
+	if (!format)
+		return;
+
+	for (i = 0; i < format->planes; i++)
+		buffer->data[i] = base ? base + buffer->offsets[i] : NULL;
+}
+
+static int buffer_dma_buf_sync(struct drm_display_buffer *buffer,
+			       uint64_t flags)
+{
+	struct dma_buf_sync sync = { 0 };
+	int ret;
+
+	if (buffer->dma_buf_fd < 0)
+		return 0;
+
+	sync.flags = flags | DMA_BUF_SYNC_RW;
+
+	ret = drmIoctl(buffer->dma_buf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+	if (ret)
+		return -errno;
+
+	return 0;
+}
+
+int drm_display_buffer_map(struct drm_display *display,
+			   struct drm_display_buffer *buffer)
+{
+	struct drm_mode_map_dumb map_dumb = { 0 };
+	void *map;
+	int ret;
+
+	if (!display || !buffer)
+		return -EINVAL;
+
+	if (buffer->map)
+		goto complete;
+
+	map_dumb.handle = buffer->handles[0];
+
+	ret = drmIoctl(display->drm_fd, DRM_IOCTL_MODE_MAP_DUMB, &map_dumb);
+	if (ret)
+		return -errno;
+
+	map = mmap(0, buffer->sizes[0], PROT_READ | PROT_WRITE, MAP_SHARED,
+		   display->drm_fd, map_dumb.offset);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	buffer->map = map;
+
+	/* Shadowed buffers are always drawn to the shadow copy. */
+	if (!buffer->shadow) {
+		buffer_data_setup(buffer, buffer->map);
+
+		ret = buffer_cairo_setup(buffer);
+		if (ret)
+			goto error;
+	}
+
+complete:
+	buffer->map_count++;
+
+	return buffer_dma_buf_sync(buffer, DMA_BUF_SYNC_START);
+
+error:
+	buffer_data_setup(buffer, NULL);
+
+	munmap(buffer->map, buffer->sizes[0]);
+	buffer->map = NULL;
+
+	return ret;
+}
+
+int drm_display_buffer_unmap(struct drm_display *display,
+			     struct drm_display_buffer *buffer)
+{
+	if (!display || !buffer)
+		return -EINVAL;
+
+	if (!buffer->map_count)
+		return -EINVAL;
+
+	buffer_dma_buf_sync(buffer, DMA_BUF_SYNC_END);
+
+	buffer->map_count--;
+
+	/* CPU buffers remain mapped until teardown. */
+	if (buffer->map_count || buffer->usage == DRM_DISPLAY_BUFFER_USAGE_CPU)
+		return 0;
+
+	if (!buffer->shadow) {
+		buffer_cairo_teardown(buffer);
+		buffer_data_setup(buffer, NULL);
+	}
+
+	munmap(buffer->map, buffer->sizes[0]);
+	buffer->map = NULL;
+
+	return 0;
+}
+
+int drm_display_buffer_setup(struct drm_display *display,
+			     struct drm_display_buffer *buffer,
+			     struct drm_display_plane_setup *plane_setup)
+{
+	struct drm_mode_create_dumb create_dumb = { 0 };
+	const struct drm_display_format *format;
+	unsigned int width, height;
+	unsigned int rows;
+	unsigned int i;
+	int ret;
+
+	if (!display || !buffer || !plane_setup)
+		return -EINVAL;
+
+	buffer->width = plane_setup->buffer_width;
+	buffer->height = plane_setup->buffer_height;
+	buffer->format = plane_setup->buffer_format;
+	buffer->usage = plane_setup->buffer_usage;
+	buffer->dma_buf_fd = -1;
+
+	format = format_find(buffer->format);
+	if (!format)
+		return -EINVAL;
+
+	/* Shadowing only makes sense for buffers drawn by the CPU. */
+	if (plane_setup->buffer_shadow &&
+	    buffer->usage != DRM_DISPLAY_BUFFER_USAGE_CPU)
+		return -EINVAL;
+
+	width = ALIGN(buffer->width, format->align);
+	height = ALIGN(buffer->height, format->vsub);
+
+	/* Express the size of all planes in rows of the first plane. */
+	rows = height * format->cpp[0] * format->hsub;
+
+	for (i = 1; i < format->planes; i++)
+		rows += height / format->vsub * format->cpp[i];
+
+	create_dumb.width = width;
+	create_dumb.height = DIV_ROUND_UP(rows, format->cpp[0] * format->hsub);
+	create_dumb.bpp = format->cpp[0] * 8;
+
+	ret = drmIoctl(display->drm_fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_dumb);
+	if (ret)
+		return -errno;
+
+	buffer->handles[0] = create_dumb.handle;
+	buffer->strides[0] = create_dumb.pitch;
+	buffer->sizes[0] = create_dumb.size;
+
+	for (i = 1; i < format->planes; i++) {
+		unsigned int divider = format->cpp[0] * format->hsub;
+		unsigned int rows_previous = i > 1 ? height / format->vsub :
+				height;
+
+		if ((buffer->strides[0] * format->cpp[i]) % divider)
+			goto error;
+
+		buffer->handles[i] = buffer->handles[0];
+		buffer->strides[i] = buffer->strides[0] * format->cpp[i] /
+				     divider;
+		buffer->offsets[i] = buffer->offsets[i - 1] +
+				     buffer->strides[i - 1] * rows_previous;
+	}
+
+	ret = drmModeAddFB2(display->drm_fd, buffer->width, buffer->height,
+			    buffer->format, buffer->handles, buffer->strides,
+			    buffer->offsets, &buffer->fb_id, 0);
+	if (ret)
+		goto error;
+
+	if (plane_setup->buffer_shadow) {
+		buffer->shadow = aligned_alloc(64, ALIGN(buffer->sizes[0], 64));
+		if (!buffer->shadow)
+			goto error;
+
+		memset(buffer->shadow, 0, buffer->sizes[0]);
+
+		buffer_data_setup(buffer, buffer->shadow);
+
+		ret = buffer_cairo_setup(buffer);
+		if (ret)
+			goto error;
+	}
+
+	/* Other buffers are only mapped on CPU access. */
+	if (buffer->usage == DRM_DISPLAY_BUFFER_USAGE_CPU) {
+		ret = drm_display_buffer_map(display, buffer);
+		if (ret)
+			goto error;
+	}
+
+	return 0;
+
+error:
+	buffer_cairo_teardown(buffer);
+
+	if (buffer->fb_id)
+		drmModeRmFB(display->drm_fd, buffer->fb_id);
+
+	if (create_dumb.handle) {
+		struct drm_mode_destroy_dumb destroy_dumb = { 0 };
+
+		destroy_dumb.handle = buffer->handles[0];
+
+		drmIoctl(display->drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB,
+			 &destroy_dumb);
+	}
+
+	if (buffer->map)
+		munmap(buffer->map, buffer->sizes[0]);
+
+	if (buffer->shadow)
+		free(buffer->shadow);
+
+	memset(buffer, 0, sizeof(*buffer));
+
+	return -1;
+}
+
+int drm_display_buffer_teardown(struct drm_display *display,
+				struct drm_display_buffer *buffer)
+{
+	struct drm_mode_destroy_dumb destroy_dumb = { 0 };
+
+	if (!display || !buffer)
+		return -EINVAL;
+
+	buffer_cairo_teardown(buffer);
+
+	drmModeRmFB(display->drm_fd, buffer->fb_id);
+
+	if (buffer->map)
+		munmap(buffer->map, buffer->sizes[0]);
+
+	if (buffer->shadow)
+		free(buffer->shadow);
+
+	if (buffer->dma_buf_fd > 0)
+		close(buffer->dma_buf_fd);
+
+	if (buffer->hash_blocks)
+		free(buffer->hash_blocks);
+
+	destroy_dumb.handle = buffer->handles[0];
+	drmIoctl(display->drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_dumb);
+
+	memset(buffer, 0, sizeof(*buffer));
+
+	return 0;
+}
+
+static void fb_cache_entry_destroy(struct drm_display *display,
+				   struct drm_display_fb_cache_entry *entry)
+{
+	struct drm_display_fb_cache *cache = &display->fb_cache;
+	struct drm_display_buffer *buffer = &entry->buffer;
+	bool shared = false;
+	unsigned int i;
+
+	if (buffer->fb_id) {
+		drmModeRmFB(display->drm_fd, buffer->fb_id);
+		cache->stats.ioctls++;
+	}
+
+	if (buffer->hash_blocks)
+		free(buffer->hash_blocks);
+
+	entry->used = false;
+
+	/* Layouts of the same dma-buf share its handle. */
+	for (i = 0; i < ARRAY_SIZE(cache->entries); i++)
+		if (cache->entries[i].used &&
+		    cache->entries[i].buffer.handles[0] == buffer->handles[0])
+			shared = true;
+
+	if (!shared) {
+		drmCloseBufferHandle(display->drm_fd, buffer->handles[0]);
+		cache->stats.ioctls++;
+	}
+
+	memset(entry, 0, sizeof(*entry));
+}
+
+static struct drm_display_fb_cache_entry *fb_cache_evictable(struct drm_display *display)
+{
+	struct drm_display_fb_cache *cache = &display->fb_cache;
+	struct drm_display_fb_cache_entry *evictable = NULL;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(cache->entries); i++) {
+		struct drm_display_fb_cache_entry *entry = &cache->entries[i];
+
+		if (!entry->used || entry->buffer.references)
+			continue;
+
+		if (!evictable || entry->serial < evictable->serial)
+			evictable = entry;
+	}
+
+	return evictable;
+}
+
+static void fb_cache_trim(struct drm_display *display)
+{
+	struct drm_display_fb_cache *cache = &display->fb_cache;
+	struct drm_display_fb_cache_entry *entry;
+	unsigned int count = 0;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(cache->entries); i++)
+		if (cache->entries[i].used)
+			count++;
+
+	while (count > cache->capacity) {
+		entry = fb_cache_evictable(display);
+		if (!entry)
+			break;
+
+		fb_cache_entry_destroy(display, entry);
+		cache->stats.evictions++;
+		count--;
+	}
+}
+
+struct drm_display_buffer *drm_display_buffer_import(struct drm_display *display,
+						      int fd, unsigned int width,
+						      unsigned int height,
+						      uint32_t format,
+						      const uint32_t *strides,
+						      const uint32_t *offsets)
+{
+	struct drm_display_fb_cache *cache;
+	struct drm_display_fb_cache_entry *entry = NULL;
+	struct drm_display_buffer *buffer;
+	const struct drm_display_format *format_info;
+	struct stat stat_buffer;
+	unsigned int planes;
+	unsigned int i, j;
+	uint32_t handle;
+	int ret;
+
+	if (!display || fd < 0 || !strides || !offsets)
+		return NULL;
+
+	format_info = format_find(format);
+	if (!format_info)
+		return NULL;
+
+	planes = format_info->planes;
+	cache = &display->fb_cache;
+
+	ret = fstat(fd, &stat_buffer);
+	if (ret)
+		return NULL;
+
+	cache->stats.lookups++;
+
+	for (i = 0; i < ARRAY_SIZE(cache->entries); i++) {
+		entry = &cache->entries[i];
+		buffer = &entry->buffer;
+
+		if (!entry->used || entry->device != stat_buffer.st_dev ||
+		    entry->inode != stat_buffer.st_ino ||
+		    buffer->width != width || buffer->height != height ||
+		    buffer->format != format)
+			continue;
+
+		for (j = 0; j < planes; j++)
+			if (buffer->strides[j] != strides[j] ||
+			    buffer->offsets[j] != offsets[j])
+				break;
+
+		if (j == planes) {
+			cache->stats.hits++;
+			goto complete;
+		}
+	}
+
+	entry = NULL;
+
+	for (i = 0; i < ARRAY_SIZE(cache->entries); i++) {
+		if (!cache->entries[i].used) {
+			entry = &cache->entries[i];
+			break;
+		}
+	}
+
+	if (!entry) {
+		entry = fb_cache_evictable(display);
+		if (!entry)
+			return NULL;
+
+		fb_cache_entry_destroy(display, entry);
+		cache->stats.evictions++;
+	}
+
+	ret = drmPrimeFDToHandle(display->drm_fd, fd, &handle);
+	cache->stats.ioctls++;
+	if (ret)
+		return NULL;
+
+	buffer = &entry->buffer;
+	buffer->width = width;
+	buffer->height = height;
+	buffer->format = format;
+	buffer->usage = DRM_DISPLAY_BUFFER_USAGE_DEVICE;
+	buffer->dma_buf_fd = -1;
+	buffer->imported = true;
+
+	for (i = 0; i < planes; i++) {
+		buffer->handles[i] = handle;
+		buffer->strides[i] = strides[i];
+		buffer->offsets[i] = offsets[i];
+	}
+
+	ret = drmModeAddFB2(display->drm_fd, width, height, format,
+			    buffer->handles, buffer->strides, buffer->offsets,
+			    &buffer->fb_id, 0);
+	cache->stats.ioctls++;
+	if (ret) {
+		entry->used = true;
+		fb_cache_entry_destroy(display, entry);
+		return NULL;
+	}
+
+	entry->device = stat_buffer.st_dev;
+	entry->inode = stat_buffer.st_ino;
+	entry->used = true;
+
+complete:
+	entry->serial = ++cache->serial;
+	entry->buffer.references++;
+
+	return &entry->buffer;
+}
+
+int drm_display_buffer_release(struct drm_display *display,
+			       struct drm_display_buffer *buffer)
+{
+	if (!display || !buffer || !buffer->imported)
+		return -EINVAL;
+
+	if (!buffer->references)
+		return -EINVAL;
+
+	buffer->references--;
+
+	/* Framebuffers stay cached while there is room for them. */
+	if (!buffer->references)
+		fb_cache_trim(display);
+
+	return 0;
+}
+
+static void fb_cache_flush(struct drm_display *display)
+{
+	struct drm_display_fb_cache *cache = &display->fb_cache;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(cache->entries); i++)
+		if (cache->entries[i].used)
+			fb_cache_entry_destroy(display, &cache->entries[i]);
+}
+
+static void plane_setup_visible_set(struct drm_display *display,
+				    struct drm_display_plane_setup *plane_setup,
+				    struct drm_display_buffer *buffer)
+{
+	struct drm_display_buffer *buffer_previous =
+		plane_setup->buffer_visible;
+
+	if (buffer == buffer_previous)
+		return;
+
+	plane_setup->buffer_visible = buffer;
+
+	/* Scanout holds a reference on imported buffers while visible. */
+	if (buffer && buffer->imported)
+		buffer->references++;
+
+	if (buffer_previous && buffer_previous->imported)
+		drm_display_buffer_release(display, buffer_previous);
+}
+
+struct drm_display_request {
+	drmModeAtomicReqPtr atomic;
+	struct drm_display *display;
+
+	/* Copy of the properties, only kept when commits are hooked. */
+	struct drm_display_commit_item *items;
+	unsigned int items_count;
+	unsigned int items_size;
+
+	struct drm_display_commit_buffer buffers[8];
+	unsigned int buffers_count;
+	bool truncated;
+};
+
+static uint64_t time_us(void)
+{
+	struct timespec timespec = { 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &timespec);
+
+	return (uint64_t)timespec.tv_sec * 1000000 + timespec.tv_nsec / 1000;
+}
+
+static struct drm_display_request *request_alloc(struct drm_display *display)
+{
+	struct drm_display_request *request;
+
+	request = calloc(1, sizeof(*request));
+	if (!request)
+		return NULL;
+
+	request->atomic = drmModeAtomicAlloc();
+	if (!request->atomic) {
+		free(request);
+		return NULL;
+	}
+
+	request->display = display;
+
+	return request;
+}
+
+static void request_free(struct drm_display_request *request)
+{
+	drmModeAtomicFree(request->atomic);
+
+	if (request->items)
+		free(request->items);
+
+	free(request);
+}
+
+static int request_property_add(struct drm_display_request *request,
+				uint32_t object_id, uint32_t property_id,
+				uint64_t value)
+{
+	struct drm_display_commit_item *item;
+	int ret;
+
+	ret = drmModeAtomicAddProperty(request->atomic, object_id,
+				       property_id, value);
+	if (ret < 0 || !request->display->commit_hook)
+		return ret;
+
+	if (request->items_count == request->items_size) {
+		unsigned int size = request->items_size ?
+				    request->items_size * 2 : 32;
+
+		item = realloc(request->items, size * sizeof(*item));
+		if (!item) {
+			request->truncated = true;
+			return ret;
+		}
+
+		request->items = item;
+		request->items_size = size;
+	}
+
+	item = &request->items[request->items_count++];
+	item->object_id = object_id;
+	item->property_id = property_id;
+	item->value = value;
+
+	return ret;
+}
+
+static int request_buffer_add(struct drm_display_request *request,
+			      uint32_t object_id, uint32_t property_id,
+			      const struct drm_display_buffer *buffer)
+{
+	struct drm_display_commit_buffer *identity;
+	int ret;
+
+	ret = request_property_add(request, object_id, property_id,
+				   buffer->fb_id);
+	if (ret < 0 || !request->display->commit_hook)
+		return ret;
+
+	if (request->buffers_count == ARRAY_SIZE(request->buffers)) {
+		request->truncated = true;
+		return ret;
+	}
+
+	identity = &request->buffers[request->buffers_count++];
+	identity->fb_id = buffer->fb_id;
+	identity->width = buffer->width;
+	identity->height = buffer->height;
+	identity->format = buffer->format;
+
+	return ret;
+}
+
+static int request_commit(struct drm_display_request *request,
+			  uint32_t flags)
+{
+	struct drm_display *display = request->display;
+	struct drm_display_commit commit = { 0 };
+	int error;
+	int ret;
+
+	if (!display->commit_hook)
+		return drmModeAtomicCommit(display->drm_fd, request->atomic,
+					   flags, NULL);
+
+	commit.items = request->items;
+	commit.items_count = request->items_count;
+	commit.buffers = request->buffers;
+	commit.buffers_count = request->buffers_count;
+	commit.flags = flags;
+	commit.truncated = request->truncated;
+	commit.time_us = time_us();
+
+	ret = drmModeAtomicCommit(display->drm_fd, request->atomic, flags,
+				  NULL);
+	error = errno;
+
+	commit.duration_us = time_us() - commit.time_us;
+	commit.result = ret ? -error : 0;
+
+	display->commit_hook(display, &commit, display->commit_hook_private);
+
+	/* Callers report errors from errno. */
+	errno = error;
+
+	return ret;
+}
+
+static void plane_setup_source_add(struct drm_display_request *request,
+				   struct drm_display_plane_setup *plane_setup)
+{
+	struct drm_display_plane_properties *plane_properties =
+		&plane_setup->plane.properties;
+	uint32_t plane_id = plane_setup->plane.id;
+
+	request_property_add(request, plane_id, plane_properties->src_w,
+			     plane_setup->source_width << 16);
+	request_property_add(request, plane_id, plane_properties->src_h,
+			     plane_setup->source_height << 16);
+	request_property_add(request, plane_id, plane_properties->src_x,
+			     plane_setup->source_x << 16);
+	request_property_add(request, plane_id, plane_properties->src_y,
+			     plane_setup->source_y << 16);
+}
+
+static void plane_setup_display_add(struct drm_display_request *request,
+				    struct drm_display_plane_setup *plane_setup)
+{
+	struct drm_display_plane_properties *plane_properties =
+		&plane_setup->plane.properties;
+	uint32_t plane_id = plane_setup->plane.id;
+
+	request_property_add(request, plane_id, plane_properties->crtc_w,
+			     plane_setup->display_width);
+	request_property_add(request, plane_id, plane_properties->crtc_h,
+			     plane_setup->display_height);
+	request_property_add(request, plane_id, plane_properties->crtc_x,
+			     (int64_t)plane_setup->display_x);
+	request_property_add(request, plane_id, plane_properties->crtc_y,
+			     (int64_t)plane_setup->display_y);
+}
+
+static void plane_setup_rotation_add(struct drm_display_request *request,
+				     struct drm_display_plane_setup *plane_setup)
+{
+	struct drm_display_plane_properties *plane_properties =
+		&plane_setup->plane.properties;
+
+	if (!plane_properties->rotation)
+		return;
+
+	request_property_add(request, plane_setup->plane.id,
+			     plane_properties->rotation,
+			     plane_setup->rotation);
+}
+
+static void plane_setup_composition_add(struct drm_display_request *request,
+					struct drm_display_plane_setup *plane_setup)
+{
+	struct drm_display_plane *plane = &plane_setup->plane;
+	struct drm_display_plane_properties *plane_properties =
+		&plane->properties;
+
+	if (plane_setup->zpos_update)
+		request_property_add(request, plane->id,
+				     plane_properties->zpos,
+				     plane_setup->zpos);
+
+	if (plane_setup->alpha_update)
+		request_property_add(request, plane->id,
+				     plane_properties->alpha,
+				     plane_setup->alpha);
+
+	if (plane_setup->blend_mode_update)
+		request_property_add(request, plane->id,
+				     plane_properties->pixel_blend_mode,
+				     plane->blend_modes[plane_setup->blend_mode]);
+}
+
+static void plane_setup_updates_add(struct drm_display_request *request,
+				    struct drm_display_plane_setup *plane_setup)
+{
+	struct drm_display_buffer *buffer = plane_setup->buffer_pending;
+
+	if (!plane_setup->configured)
+		return;
+
+	/* The plane is already bound to the CRTC, only the buffer changes. */
+	if (buffer) {
+		buffer_commit_prepare(buffer);
+		request_buffer_add(request, plane_setup->plane.id,
+				   plane_setup->plane.properties.fb_id, buffer);
+	}
+
+	if (plane_setup->source_update)
+		plane_setup_source_add(request, plane_setup);
+
+	if (plane_setup->display_update)
+		plane_setup_display_add(request, plane_setup);
+
+	if (plane_setup->rotation_update)
+		plane_setup_rotation_add(request, plane_setup);
+
+	plane_setup_composition_add(request, plane_setup);
+}
+
+static void output_color_add(struct drm_display *display,
+			     struct drm_display_request *request)
+{
+	struct drm_display_crtc_properties *crtc_properties =
+		&display->output.crtc_properties;
+	uint32_t crtc_id = display->output.crtc_id;
+
+	if (!display->output.color_update)
+		return;
+
+	if (crtc_properties->gamma_lut)
+		request_property_add(request, crtc_id,
+				     crtc_properties->gamma_lut,
+				     display->output.gamma_lut_blob_id);
+
+	if (crtc_properties->degamma_lut)
+		request_property_add(request, crtc_id,
+				     crtc_properties->degamma_lut,
+				     display->output.degamma_lut_blob_id);
+
+	if (crtc_properties->ctm)
+		request_property_add(request, crtc_id,
+				     crtc_properties->ctm,
+				     display->output.ctm_blob_id);
+}
+
+static bool plane_setup_updates_pending(struct drm_display_plane_setup *plane_setup)
+{
+	if (!plane_setup->configured)
+		return false;
+
+	return plane_setup->buffer_pending ||
+	       plane_setup->source_update || plane_setup->display_update ||
+	       plane_setup->rotation_update || plane_setup->zpos_update ||
+	       plane_setup->alpha_update || plane_setup->blend_mode_update;
+}
+
+static void plane_setup_updates_complete(struct drm_display_plane_setup *plane_setup)
+{
+	plane_setup->buffer_pending = NULL;
+	plane_setup->source_update = false;
+	plane_setup->display_update = false;
+	plane_setup->rotation_update = false;
+	plane_setup->zpos_update = false;
+	plane_setup->alpha_update = false;
+	plane_setup->blend_mode_update = false;
+}
+
+static uint32_t writeback_add(struct drm_display *display,
+			      struct drm_display_request *request)
+{
+	struct drm_display_writeback *writeback = &display->writeback;
+	struct drm_display_writeback_properties *properties =
+		&writeback->properties;
+	struct drm_display_buffer *buffer;
+	uint32_t connector_id = writeback->connector_id;
+	uint32_t flags = 0;
+
+	if (!writeback->capture_update)
+		return 0;
+
+	buffer = &writeback->buffers[writeback->capture_index];
+
+	/* Routing the connector to the CRTC is only allowed as a modeset. */
+	if (!writeback->attached) {
+		request_property_add(request, connector_id,
+				     properties->crtc_id,
+				     display->output.crtc_id);
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+
+	writeback->out_fence = -1;
+
+	request_buffer_add(request, connector_id, properties->fb_id, buffer);
+	request_property_add(request, connector_id,
+			     properties->out_fence_ptr,
+			     (uint64_t)(uintptr_t)&writeback->out_fence);
+
+	return flags;
+}
+
+static void writeback_complete(struct drm_display *display)
+{
+	struct drm_display_writeback *writeback = &display->writeback;
+
+	if (!writeback->capture_update)
+		return;
+
+	writeback->fences[writeback->capture_index] = writeback->out_fence;
+	writeback->capture_index++;
+	writeback->capture_index %= writeback->buffers_count;
+	writeback->captures_count++;
+
+	writeback->capture_update = false;
+	writeback->attached = true;
+}
+
+/*
+ * Pending property updates of every plane are folded into the next commit,
+ * whichever plane it targets. Returns the commit flags they require.
+ */
+static uint32_t display_updates_add(struct drm_display *display,
+				    struct drm_display_request *request)
+{
+	plane_setup_updates_add(request, &display->primary_setup);
+	plane_setup_updates_add(request, &display->overlay_setup);
+	plane_setup_updates_add(request, &display->cursor_setup);
+
+	output_color_add(display, request);
+
+	return writeback_add(display, request);
+}
+
+static bool display_updates_pending(struct drm_display *display)
+{
+	return plane_setup_updates_pending(&display->primary_setup) ||
+	       plane_setup_updates_pending(&display->overlay_setup) ||
+	       plane_setup_updates_pending(&display->cursor_setup) ||
+	       display->output.color_update ||
+	       display->writeback.capture_update;
+}
+
+static void plane_setup_buffer_complete(struct drm_display *display,
+					struct drm_display_plane_setup *plane_setup)
+{
+	struct drm_display_buffer *buffer = plane_setup->buffer_pending;
+
+	if (!buffer)
+		return;
+
+	plane_setup_visible_set(display, plane_setup, buffer);
+	buffer_damage_reset(buffer);
+
+	display->stats.flips_committed++;
+}
+
+static void display_updates_complete(struct drm_display *display)
+{
+	plane_setup_buffer_complete(display, &display->primary_setup);
+	plane_setup_buffer_complete(display, &display->overlay_setup);
+	plane_setup_buffer_complete(display, &display->cursor_setup);
+
+	plane_setup_updates_complete(&display->primary_setup);
+	plane_setup_updates_complete(&display->overlay_setup);
+	plane_setup_updates_complete(&display->cursor_setup);
+
+	display->output.color_update = false;
+
+	writeback_complete(display);
+}
+
+static int display_updates_commit(struct drm_display *display, uint32_t flags)
+{
+	struct drm_display_request *request;
+	int ret;
+
+	if (!display_updates_pending(display))
+		return 0;
+
+	request = request_alloc(display);
+	if (!request)
+		return -ENOMEM;
+
+	flags |= display_updates_add(display, request);
+
+	ret = request_commit(request, flags);
+	if (ret) {
+		ret = -errno;
+		goto complete;
+	}
+
+	display_updates_complete(display);
+
+complete:
+	request_free(request);
+
+	return ret;
+}
+
+static void plane_setup_dimensions(struct drm_display_plane_setup *plane_setup)
+{
+	struct drm_display_dynamic_resolution *dynamic_resolution =
+		&plane_setup->dynamic_resolution;
+
+	if (!plane_setup->display_width || !plane_setup->display_height) {
+		plane_setup->display_width = plane_setup->buffer_width;
+		plane_setup->display_height = plane_setup->buffer_height;
+	}
+
+	if (!plane_setup->source_width || !plane_setup->source_height) {
+		plane_setup->source_width = plane_setup->buffer_width;
+		plane_setup->source_height = plane_setup->buffer_height;
+	}
+
+	if (!plane_setup->rotation)
+		plane_setup->rotation = DRM_MODE_ROTATE_0;
+
+	if (!dynamic_resolution->scale)
+		dynamic_resolution->scale = 1000;
+
+	if (!dynamic_resolution->scale_min)
+		dynamic_resolution->scale_min = 500;
+}
+
+/*
+ * The new source rectangle applies to the next commit, so this has to be
+ * called after flipping a frame and before rendering the next one.
+ */
+int drm_display_dynamic_resolution_update(struct drm_display *display,
+					  struct drm_display_plane_setup *plane_setup,
+					  unsigned int render_time_us)
+{
+	struct drm_display_dynamic_resolution *dynamic_resolution;
+	unsigned int budget_us;
+	unsigned int scale;
+	unsigned int width, height;
+
+	if (!display || !plane_setup)
+		return -EINVAL;
+
+	dynamic_resolution = &plane_setup->dynamic_resolution;
+	if (!dynamic_resolution->enabled)
+		return 0;
+
+	budget_us = dynamic_resolution->budget_us;
+	if (!budget_us && display->output.mode.vrefresh)
+		budget_us = 1000000 / display->output.mode.vrefresh;
+
+	if (!budget_us)
+		return -EINVAL;
+
+	scale = dynamic_resolution->scale;
+
+	/*
+	 * Render time scales with the pixel count, so shrink both dimensions
+	 * by the square root of the overshoot to get back under 80% of the
+	 * budget right away and grow back slowly once there is headroom.
+	 */
+	if (render_time_us > budget_us * 9 / 10)
+		scale = scale * sqrt((double)budget_us * 8 / 10 /
+				     render_time_us);
+	else if (render_time_us < budget_us * 6 / 10)
+		scale += 25;
+
+	if (scale > 1000)
+		scale = 1000;
+	else if (scale < dynamic_resolution->scale_min)
+		scale = dynamic_resolution->scale_min;
+
+	dynamic_resolution->scale = scale;
+
+	/* Keep even dimensions for chroma subsampled formats. */
+	width = (plane_setup->buffer_width * scale / 1000) & ~1;
+	height = (plane_setup->buffer_height * scale / 1000) & ~1;
+
+	if (width < 2)
+		width = 2;
+	if (height < 2)
+		height = 2;
+
+	if (width == plane_setup->source_width &&
+	    height == plane_setup->source_height)
+		return 0;
+
+	plane_setup->source_width = width;
+	plane_setup->source_height = height;
+	plane_setup->source_update = true;
+
+	/* Growing back may push a panned source rectangle off the buffer. */
+	if (plane_setup->source_x + width > plane_setup->buffer_width)
+		plane_setup->source_x = plane_setup->buffer_width - width;
+
+	if (plane_setup->source_y + height > plane_setup->buffer_height)
+		plane_setup->source_y = plane_setup->buffer_height - height;
+
+	return 0;
+}
+
+int drm_display_plane_pan(struct drm_display *display,
+			  struct drm_display_plane_setup *plane_setup,
+			  unsigned int x, unsigned int y)
+{
+	if (!display || !plane_setup)
+		return -EINVAL;
+
+	/* The source rectangle has to remain within the buffer. */
+	if (x + plane_setup->source_width > plane_setup->buffer_width ||
+	    y + plane_setup->source_height > plane_setup->buffer_height)
+		return -EINVAL;
+
+	if (plane_setup->source_x == x && plane_setup->source_y == y)
+		return 0;
+
+	plane_setup->source_x = x;
+	plane_setup->source_y = y;
+	plane_setup->source_update = true;
+
+	return 0;
+}
+
+int drm_display_plane_move(struct drm_display *display,
+			   struct drm_display_plane_setup *plane_setup,
+			   int x, int y)
+{
+	if (!display || !plane_setup)
+		return -EINVAL;
+
+	if (plane_setup->display_x == x && plane_setup->display_y == y)
+		return 0;
+
+	plane_setup->display_x = x;
+	plane_setup->display_y = y;
+	plane_setup->display_update = true;
+
+	return 0;
+}
+
+int drm_display_plane_resize(struct drm_display *display,
+			     struct drm_display_plane_setup *plane_setup,
+			     unsigned int width, unsigned int height)
+{
+	if (!display || !plane_setup || !width || !height)
+		return -EINVAL;
+
+	if (plane_setup->display_width == width &&
+	    plane_setup->display_height == height)
+		return 0;
+
+	plane_setup->display_width = width;
+	plane_setup->display_height = height;
+	plane_setup->display_update = true;
+
+	return 0;
+}
+
+int drm_display_plane_zpos_set(struct drm_display *display,
+			       struct drm_display_plane_setup *plane_setup,
+			       uint64_t zpos)
+{
+	struct drm_display_plane *plane;
+
+	if (!display || !plane_setup)
+		return -EINVAL;
+
+	plane = &plane_setup->plane;
+
+	if (!plane->properties.zpos || plane->zpos_immutable)
+		return -EOPNOTSUPP;
+
+	if (zpos < plane->zpos_min || zpos > plane->zpos_max)
+		return -EINVAL;
+
+	plane_setup->zpos = zpos;
+	plane_setup->zpos_update = true;
+
+	return 0;
+}
+
+int drm_display_plane_alpha_set(struct drm_display *display,
+				struct drm_display_plane_setup *plane_setup,
+				uint16_t alpha)
+{
+	if (!display || !plane_setup)
+		return -EINVAL;
+
+	if (!plane_setup->plane.properties.alpha)
+		return -EOPNOTSUPP;
+
+	plane_setup->alpha = alpha;
+	plane_setup->alpha_update = true;
+
+	return 0;
+}
+
+int drm_display_plane_blend_mode_set(struct drm_display *display,
+				     struct drm_display_plane_setup *plane_setup,
+				     enum drm_display_blend_mode blend_mode)
+{
+	struct drm_display_plane *plane;
+
+	if (!display || !plane_setup ||
+	    blend_mode >= ARRAY_SIZE(plane->blend_modes))
+		return -EINVAL;
+
+	plane = &plane_setup->plane;
+
+	if (!plane->properties.pixel_blend_mode ||
+	    !(plane->blend_modes_supported & (1 << blend_mode)))
+		return -EOPNOTSUPP;
+
+	plane_setup->blend_mode = blend_mode;
+	plane_setup->blend_mode_update = true;
+
+	return 0;
+}
+
+int drm_display_cursor_move(struct drm_display *display, int x, int y)
+{
+	struct drm_display_plane_setup *plane_setup;
+	int ret;
+
+	if (!display)
+		return -EINVAL;
+
+	plane_setup = &display->cursor_setup;
+	if (!plane_setup->plane.id)
+		return -ENODEV;
+
+	if (plane_setup->display_x == x && plane_setup->display_y == y)
+		return 0;
+
+	drm_display_plane_move(display, plane_setup, x, y);
+
+	if (!plane_setup->configured)
+		return 0;
+
+	/*
+	 * Only the cursor position is sent when no other commit is in flight.
+	 * Otherwise, it is folded into the next commit.
+	 */
+	ret = display_updates_commit(display, DRM_MODE_ATOMIC_NONBLOCK);
+	if (ret == -EBUSY) {
+		display->stats.cursor_moves_folded++;
+		return 0;
+	} else if (!ret) {
+		display->stats.cursor_moves_committed++;
+	}
+
+	return ret;
+}
+
+static int color_lut_blob_create(struct drm_display *display,
+				 unsigned int size,
+				 double (*curve)(double value,
+						 unsigned int channel,
+						 void *private),
+				 void *private, uint32_t *blob_id)
+{
+	struct drm_color_lut *lut;
+	unsigned int i, j;
+	int ret;
+
+	if (size < 2)
+		return -EINVAL;
+
+	lut = calloc(size, sizeof(*lut));
+	if (!lut)
+		return -ENOMEM;
+
+	for (i = 0; i < size; i++) {
+		double value = (double)i / (size - 1);
+		uint16_t entries[3];
+
+		for (j = 0; j < ARRAY_SIZE(entries); j++) {
+			double entry = curve(value, j, private);
+
+			if (entry < 0.0)
+				entry = 0.0;
+			else if (entry > 1.0)
+				entry = 1.0;
+
+			entries[j] = entry * 0xffff + 0.5;
+		}
+
+		lut[i].red = entries[0];
+		lut[i].green = entries[1];
+		lut[i].blue = entries[2];
+	}
+
+	ret = drmModeCreatePropertyBlob(display->drm_fd, lut,
+					size * sizeof(*lut), blob_id);
+	if (ret)
+		ret = -errno;
+
+	free(lut);
+
+	return ret;
+}
+
+static int color_blob_replace(struct drm_display *display, uint32_t *blob_id,
+			      uint32_t blob_id_new)
+{
+	/* The kernel keeps a reference for as long as the blob is in use. */
+	if (*blob_id)
+		drmModeDestroyPropertyBlob(display->drm_fd, *blob_id);
+
+	*blob_id = blob_id_new;
+	display->output.color_update = true;
+
+	return 0;
+}
+
+int drm_display_gamma_lut_set(struct drm_display *display,
+			      double (*curve)(double value,
+					      unsigned int channel,
+					      void *private),
+			      void *private)
+{
+	uint32_t blob_id = 0;
+	int ret;
+
+	if (!display)
+		return -EINVAL;
+
+	if (!display->output.crtc_properties.gamma_lut)
+		return -EOPNOTSUPP;
+
+	if (curve) {
+		ret = color_lut_blob_create(display,
+					    display->output.gamma_lut_size,
+					    curve, private, &blob_id);
+		if (ret)
+			return ret;
+	}
+
+	return color_blob_replace(display, &display->output.gamma_lut_blob_id,
+				  blob_id);
+}
+
+int drm_display_degamma_lut_set(struct drm_display *display,
+				double (*curve)(double value,
+						unsigned int channel,
+						void *private),
+				void *private)
+{
+	uint32_t blob_id = 0;
+	int ret;
+
+	if (!display)
+		return -EINVAL;
+
+	if (!display->output.crtc_properties.degamma_lut)
+		return -EOPNOTSUPP;
+
+	if (curve) {
+		ret = color_lut_blob_create(display,
+					    display->output.degamma_lut_size,
+					    curve, private, &blob_id);
+		if (ret)
+			return ret;
+	}
+
+	return color_blob_replace(display,
+				  &display->output.degamma_lut_blob_id,
+				  blob_id);
+}
+
+int drm_display_ctm_set(struct drm_display *display, const double *matrix)
+{
+	struct drm_color_ctm ctm = { 0 };
+	uint32_t blob_id = 0;
+	unsigned int i;
+	int ret;
+
+	if (!display)
+		return -EINVAL;
+
+	if (!display->output.crtc_properties.ctm)
+		return -EOPNOTSUPP;
+
+	if (matrix) {
+		/* Coefficients are S31.32 sign-magnitude fixed-point. */
+		for (i = 0; i < ARRAY_SIZE(ctm.matrix); i++) {
+			double coefficient = matrix[i];
+			uint64_t sign = 0;
+
+			if (coefficient < 0) {
+				coefficient = -coefficient;
+				sign = 1ULL << 63;
+			}
+
+			ctm.matrix[i] = sign |
+					(uint64_t)(coefficient * (1ULL << 32));
+		}
+
+		ret = drmModeCreatePropertyBlob(display->drm_fd, &ctm,
+						sizeof(ctm), &blob_id);
+		if (ret)
+			return -errno;
+	}
+
+	return color_blob_replace(display, &display->output.ctm_blob_id,
+				  blob_id);
+}
+
+int drm_display_writeback_capture(struct drm_display *display)
+{
+	struct drm_display_writeback *writeback;
+
+	if (!display)
+		return -EINVAL;
+
+	writeback = &display->writeback;
+	if (!writeback->connector_id || !writeback->buffers_count)
+		return -ENODEV;
+
+	if (writeback->capture_update)
+		return 0;
+
+	/* The next buffer of the ring is pending or still held. */
+	if (writeback->captures_count == writeback->buffers_count ||
+	    writeback->held[writeback->capture_index])
+		return -EBUSY;
+
+	writeback->capture_update = true;
+
+	return 0;
+}
+
+struct drm_display_buffer *drm_display_writeback_wait(struct drm_display *display,
+						       int timeout)
+{
+	struct drm_display_writeback *writeback;
+	struct drm_display_buffer *buffer;
+	struct pollfd pollfd = { 0 };
+	unsigned int index;
+	int ret;
+
+	if (!display)
+		return NULL;
+
+	writeback = &display->writeback;
+	if (!writeback->captures_count)
+		return NULL;
+
+	index = writeback->complete_index;
+
+	if (writeback->fences[index] >= 0) {
+		pollfd.fd = writeback->fences[index];
+		pollfd.events = POLLIN;
+
+		ret = poll(&pollfd, 1, timeout);
+		if (ret <= 0)
+			return NULL;
+
+		close(writeback->fences[index]);
+		writeback->fences[index] = -1;
+	}
+
+	buffer = &writeback->buffers[index];
+	writeback->held[index] = true;
+
+	writeback->complete_index++;
+	writeback->complete_index %= writeback->buffers_count;
+	writeback->captures_count--;
+
+	return buffer;
+}
+
+int drm_display_writeback_release(struct drm_display *display,
+				  struct drm_display_buffer *buffer)
+{
+	struct drm_display_writeback *writeback;
+	unsigned int index;
+
+	if (!display || !buffer)
+		return -EINVAL;
+
+	writeback = &display->writeback;
+
+	for (index = 0; index < writeback->buffers_count; index++)
+		if (buffer == &writeback->buffers[index])
+			break;
+
+	if (index == writeback->buffers_count || !writeback->held[index])
+		return -EINVAL;
+
+	writeback->held[index] = false;
+
+	return 0;
+}
+
+int drm_display_detach(struct drm_display *display,
+		       struct drm_display_plane_setup *plane_setup)
+{
+	struct drm_display_request *request;
+	struct drm_display_plane_properties *plane_properties;
+	uint32_t flags = 0;
+	uint32_t plane_id;
+	int ret;
+
+	if (!display || !plane_setup)
+		return -EINVAL;
+
+	if (!plane_setup->configured)
+		return -1;
+
+	plane_properties = &plane_setup->plane.properties;
+	plane_id = plane_setup->plane.id;
+
+	request = request_alloc(display);
+	if (!request)
+		return -ENOMEM;
+
+	request_property_add(request, plane_id, plane_properties->fb_id, 0);
+	request_property_add(request, plane_id, plane_properties->crtc_id,
+			     0);
+
+	ret = request_commit(request, flags);
+	if (ret) {
+		ret = -errno;
+		goto complete;
+	}
+
+	plane_setup_visible_set(display, plane_setup, NULL);
+	plane_setup->buffer_pending = NULL;
+	plane_setup->configured = false;
+
+complete:
+	request_free(request);
+
+	return ret;
+}
+
+static bool plane_flip_idle(struct drm_display *display,
+			    struct drm_display_plane_setup *plane_setup,
+			    struct drm_display_buffer *buffer)
+{
+	return display->idle_policy != DRM_DISPLAY_IDLE_COMMIT &&
+	       buffer_undamaged(buffer) &&
+	       (buffer == plane_setup->buffer_visible ||
+		display->idle_policy == DRM_DISPLAY_IDLE_STOP);
+}
+
+int drm_display_page_flip(struct drm_display *display,
+			  struct drm_display_plane_setup *plane_setup,
+			  struct drm_display_buffer *buffer)
+{
+	struct drm_display_request *request;
+	struct drm_display_plane_properties *plane_properties;
+	uint32_t flags = 0;
+	uint32_t plane_id;
+	int ret;
+
+	if (!display || !buffer || !plane_setup)
+		return -EINVAL;
+
+	if (!plane_setup->configured)
+		return -1;
+
+	/* A buffer staged for the plane is superseded by this one. */
+	plane_setup->buffer_pending = NULL;
+
+	if (plane_flip_idle(display, plane_setup, buffer)) {
+		/* Nothing changed on screen, only send pending updates. */
+		if (!display_updates_pending(display)) {
+			display->stats.flips_skipped++;
+			return 0;
+		}
+
+		ret = display_updates_commit(display, flags);
+		if (!ret)
+			display->stats.flips_coalesced++;
+
+		return ret;
+	}
+
+	plane_properties = &plane_setup->plane.properties;
+	plane_id = plane_setup->plane.id;
+
+	request = request_alloc(display);
+	if (!request)
+		return -ENOMEM;
+
+	buffer_commit_prepare(buffer);
+
+	request_buffer_add(request, plane_id, plane_properties->fb_id, buffer);
+	request_property_add(request, plane_id, plane_properties->crtc_id,
+			     display->output.crtc_id);
+
+	flags |= display_updates_add(display, request);
+
+	ret = request_commit(request, flags);
+	if (ret) {
+		ret = -errno;
+		goto complete;
+	}
+
+	plane_setup_visible_set(display, plane_setup, buffer);
+	buffer_damage_reset(buffer);
+
+	display_updates_complete(display);
+
+	display->stats.flips_committed++;
+
+complete:
+	request_free(request);
+
+	return ret;
+}
+
+/*
+ * Flips of several planes staged before a single drm_display_update() are
+ * shown together, instead of waiting for a commit each.
+ */
+int drm_display_page_flip_stage(struct drm_display *display,
+				struct drm_display_plane_setup *plane_setup,
+				struct drm_display_buffer *buffer)
+{
+	if (!display || !buffer || !plane_setup)
+		return -EINVAL;
+
+	if (!plane_setup->configured)
+		return -1;
+
+	if (plane_flip_idle(display, plane_setup, buffer)) {
+		plane_setup->buffer_pending = NULL;
+		display->stats.flips_skipped++;
+		return 0;
+	}
+
+	plane_setup->buffer_pending = buffer;
+
+	return 0;
+}
+
+static uint32_t plane_setup_configure_add(struct drm_display *display,
+					  struct drm_display_request *request,
+					  struct drm_display_plane_setup *plane_setup,
+					  struct drm_display_buffer *buffer)
+{
+	struct drm_display_plane_properties *plane_properties;
+	struct drm_display_crtc_properties *crtc_properties;
+	struct drm_display_connector_properties *connector_properties;
+	uint32_t flags = 0;
+	uint32_t plane_id;
+	uint32_t crtc_id;
+	uint32_t connector_id;
+
+	plane_properties = &plane_setup->plane.properties;
+	plane_id = plane_setup->plane.id;
+
+	crtc_properties = &display->output.crtc_properties;
+	crtc_id = display->output.crtc_id;
+
+	connector_properties = &display->output.connector_properties;
+	connector_id = display->output.connector_id;
+
+	if (!display->output.mode_set) {
+		if (!display->output.mode_blob_id)
+			drmModeCreatePropertyBlob(display->drm_fd,
+						  &display->output.mode,
+						  sizeof(display->output.mode),
+						  &display->output.mode_blob_id);
+
+		request_property_add(request, connector_id,
+				     connector_properties->crtc_id,
+				     crtc_id);
+
+		request_property_add(request, crtc_id,
+				     crtc_properties->active, 1);
+		request_property_add(request, crtc_id,
+				     crtc_properties->mode_id,
+				     display->output.mode_blob_id);
+
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+
+	request_buffer_add(request, plane_id, plane_properties->fb_id, buffer);
+	request_property_add(request, plane_id, plane_properties->crtc_id,
+			     display->output.crtc_id);
+
+	plane_setup_source_add(request, plane_setup);
+	plane_setup_display_add(request, plane_setup);
+	plane_setup_rotation_add(request, plane_setup);
+	plane_setup_composition_add(request, plane_setup);
+
+	return flags;
+}
+
+int drm_display_configure(struct drm_display *display,
+			  struct drm_display_plane_setup *plane_setup,
+			  struct drm_display_buffer *buffer)
+{
+	struct drm_display_request *request;
+	uint32_t flags = 0;
+	int ret;
+
+	if (!display || !buffer || !plane_setup)
+		return -EINVAL;
+
+	request = request_alloc(display);
+	if (!request)
+		return -ENOMEM;
+
+	buffer_commit_prepare(buffer);
+
+	flags |= plane_setup_configure_add(display, request, plane_setup,
+					   buffer);
+
+	/* Full state of the configured plane is already part of the commit. */
+	plane_setup_updates_complete(plane_setup);
+	flags |= display_updates_add(display, request);
+
+	ret = request_commit(request, flags);
+	if (ret) {
+		ret = -errno;
+		goto complete;
+	}
+
+	plane_setup_visible_set(display, plane_setup, buffer);
+	plane_setup->configured = true;
+	buffer_damage_reset(buffer);
+
+	display_updates_complete(display);
+
+	if (!display->output.mode_set)
+		display->output.mode_set = true;
+
+complete:
+	request_free(request);
+
+	return ret;
+}
+
+static struct drm_display_buffer *plane_setup_buffers(struct drm_display *display,
+						     struct drm_display_plane_setup *plane_setup,
+						     unsigned int *count,
+						     unsigned int **index)
+{
+	*index = NULL;
+
+	if (plane_setup == &display->primary_setup) {
+		*count = display->primary_buffers_count;
+		*index = &display->primary_buffers_index;
+		return display->primary_buffers;
+	} else if (plane_setup == &display->overlay_setup) {
+		*count = display->overlay_buffers_count;
+		*index = &display->overlay_buffers_index;
+		return display->overlay_buffers;
+	} else if (plane_setup == &display->cursor_setup) {
+		*count = 1;
+		return &display->cursor_buffer;
+	}
+
+	*count = 0;
+
+	return NULL;
+}
+
+int drm_display_plane_rotation_set(struct drm_display *display,
+				   struct drm_display_plane_setup *plane_setup,
+				   uint32_t rotation)
+{
+	struct drm_display_plane *plane;
+	struct drm_display_buffer *buffer;
+	struct drm_display_request *request;
+	unsigned int buffers_count;
+	unsigned int *buffers_index;
+	uint32_t rotation_old;
+	uint32_t flags = DRM_MODE_ATOMIC_TEST_ONLY;
+	int ret;
+
+	if (!display || !plane_setup)
+		return -EINVAL;
+
+	plane = &plane_setup->plane;
+
+	if (!plane->properties.rotation || (rotation & ~plane->rotations))
+		return rotation == DRM_MODE_ROTATE_0 ? 0 : -EOPNOTSUPP;
+
+	/* Check the rotation with the rest of the plane state. */
+	buffer = plane_setup->buffer_visible;
+	if (!buffer) {
+		buffer = plane_setup_buffers(display, plane_setup,
+					     &buffers_count, &buffers_index);
+		if (!buffers_count)
+			buffer = NULL;
+	}
+
+	if (buffer && buffer->fb_id) {
+		request = request_alloc(display);
+		if (!request)
+			return -ENOMEM;
+
+		rotation_old = plane_setup->rotation;
+		plane_setup->rotation = rotation;
+
+		flags |= plane_setup_configure_add(display, request,
+						   plane_setup, buffer);
+
+		plane_setup->rotation = rotation_old;
+
+		ret = request_commit(request, flags);
+		if (ret)
+			ret = -errno;
+
+		request_free(request);
+
+		/* The kernel rejects rotations it cannot scan out as -EINVAL. */
+		if (ret)
+			return ret;
+	}
+
+	plane_setup->rotation = rotation;
+	plane_setup->rotation_update = true;
+
+	return 0;
+}
+
+static void plane_property_diff_add(struct drm_display_request *request,
+				    uint32_t plane_id, uint32_t property_id,
+				    int64_t value, int64_t value_old,
+				    bool force)
+{
+	if (value == value_old && !force)
+		return;
+
+	request_property_add(request, plane_id, property_id, value);
+}
+
+static void buffer_scale_copy(struct drm_display_buffer *destination,
+			      const struct drm_display_buffer *source,
+			      const struct drm_display_format *format)
+{
+	unsigned int width, height;
+	unsigned int width_source, height_source;
+	unsigned int x, y, x_source, y_source;
+	unsigned int cpp;
+	uint8_t *line;
+	const uint8_t *line_source;
+	unsigned int i;
+
+	/* Nearest-neighbour, in blocks that cover hsub pixels on chroma. */
+	for (i = 0; i < format->planes; i++) {
+		width = destination->width / (i ? format->hsub : 1);
+		height = destination->height / (i ? format->vsub : 1);
+		width_source = source->width / (i ? format->hsub : 1);
+		height_source = source->height / (i ? format->vsub : 1);
+		cpp = format->cpp[i];
+
+		for (y = 0; y < height; y++) {
+			y_source = y * height_source / height;
+
+			line = (uint8_t *)destination->data[i] +
+			       y * destination->strides[i];
+			line_source = (const uint8_t *)source->data[i] +
+				      y_source * source->strides[i];
+
+			for (x = 0; x < width; x++) {
+				x_source = x * width_source / width;
+
+				memcpy(line + x * cpp, line_source +
+				       x_source * cpp, cpp);
+			}
+		}
+	}
+}
+
+/* Show the previous content on new buffers, scaled to their size. */
+static void buffer_carry_over(struct drm_display_buffer *destination,
+			      const struct drm_display_buffer *source)
+{
+	const struct drm_display_format *format;
+	cairo_t *cairo = destination->cairo;
+
+	format = format_find(destination->format);
+	if (!format || !source || !source->data[0] || !destination->data[0])
+		goto fill;
+
+	if (source->format == destination->format) {
+		buffer_scale_copy(destination, source, format);
+		return;
+	}
+
+	/* Conversion between formats is left to cairo. */
+	if (!cairo || !source->cairo_surface)
+		goto fill;
+
+	/* The source content may have been written without cairo. */
+	cairo_surface_mark_dirty(source->cairo_surface);
+
+	cairo_save(cairo);
+	cairo_reset_clip(cairo);
+	cairo_scale(cairo, (double)destination->width / source->width,
+		    (double)destination->height / source->height);
+	cairo_set_source_surface(cairo, source->cairo_surface, 0, 0);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+	cairo_paint(cairo);
+	cairo_restore(cairo);
+
+	cairo_surface_flush(destination->cairo_surface);
+
+	return;
+
+fill:
+	drm_display_buffer_fill(destination, NULL, 0xff000000);
+}
+
+int drm_display_reconfigure(struct drm_display *display,
+			    struct drm_display_plane_setup *plane_setup,
+			    const struct drm_display_plane_setup *plane_setup_new)
+{
+	struct drm_display_buffer buffers_new[ARRAY_SIZE(display->primary_buffers)] = { 0 };
+	struct drm_display_plane_setup plane_setup_old;
+	struct drm_display_plane_properties *plane_properties;
+	struct drm_display_request *request = NULL;
+	struct drm_display_buffer *buffers;
+	unsigned int buffers_count;
+	unsigned int *buffers_index;
+	uint32_t flags = 0;
+	uint32_t plane_id;
+	bool reallocate;
+	bool force;
+	unsigned int i;
+	int ret;
+
+	if (!display || !plane_setup || !plane_setup_new || !display->up)
+		return -EINVAL;
+
+	buffers = plane_setup_buffers(display, plane_setup, &buffers_count,
+				      &buffers_index);
+	if (!buffers || !buffers_count ||
+	    buffers_count > ARRAY_SIZE(buffers_new))
+		return -EINVAL;
+
+	memcpy(&plane_setup_old, plane_setup, sizeof(plane_setup_old));
+
+	reallocate = plane_setup_new->buffer_width != plane_setup->buffer_width ||
+		     plane_setup_new->buffer_height != plane_setup->buffer_height ||
+		     plane_setup_new->buffer_format != plane_setup->buffer_format ||
+		     plane_setup_new->buffer_usage != plane_setup->buffer_usage ||
+		     plane_setup_new->buffer_shadow != plane_setup->buffer_shadow;
+
+	plane_setup->buffer_width = plane_setup_new->buffer_width;
+	plane_setup->buffer_height = plane_setup_new->buffer_height;
+	plane_setup->buffer_format = plane_setup_new->buffer_format;
+	plane_setup->buffer_usage = plane_setup_new->buffer_usage;
+	plane_setup->buffer_shadow = plane_setup_new->buffer_shadow;
+
+	plane_setup->source_width = plane_setup_new->source_width;
+	plane_setup->source_height = plane_setup_new->source_height;
+	plane_setup->source_x = plane_setup_new->source_x;
+	plane_setup->source_y = plane_setup_new->source_y;
+
+	plane_setup->display_width = plane_setup_new->display_width;
+	plane_setup->display_height = plane_setup_new->display_height;
+	plane_setup->display_x = plane_setup_new->display_x;
+	plane_setup->display_y = plane_setup_new->display_y;
+
+	plane_setup->rotation = plane_setup_new->rotation;
+
+	plane_setup_dimensions(plane_setup);
+
+	/* Buffers are only reallocated when their layout changes. */
+	if (reallocate) {
+		for (i = 0; i < buffers_count; i++) {
+			ret = drm_display_buffer_setup(display, &buffers_new[i],
+						       plane_setup);
+			if (ret)
+				goto error;
+		}
+
+		buffer_carry_over(&buffers_new[0],
+				  plane_setup_old.buffer_visible);
+	}
+
+	if (!plane_setup->configured)
+		goto complete;
+
+	plane_properties = &plane_setup->plane.properties;
+	plane_id = plane_setup->plane.id;
+
+	request = request_alloc(display);
+	if (!request) {
+		ret = -ENOMEM;
+		goto error;
+	}
+
+	if (reallocate) {
+		buffer_commit_prepare(&buffers_new[0]);
+
+		request_buffer_add(request, plane_id, plane_properties->fb_id,
+				   &buffers_new[0]);
+	}
+
+	/* Only add properties that differ from the committed state. */
+	force = plane_setup_old.source_update;
+
+	plane_property_diff_add(request, plane_id, plane_properties->src_w,
+				(int64_t)plane_setup->source_width << 16,
+				(int64_t)plane_setup_old.source_width << 16,
+				force);
+	plane_property_diff_add(request, plane_id, plane_properties->src_h,
+				(int64_t)plane_setup->source_height << 16,
+				(int64_t)plane_setup_old.source_height << 16,
+				force);
+	plane_property_diff_add(request, plane_id, plane_properties->src_x,
+				(int64_t)plane_setup->source_x << 16,
+				(int64_t)plane_setup_old.source_x << 16,
+				force);
+	plane_property_diff_add(request, plane_id, plane_properties->src_y,
+				(int64_t)plane_setup->source_y << 16,
+				(int64_t)plane_setup_old.source_y << 16,
+				force);
+
+	force = plane_setup_old.display_update;
+
+	plane_property_diff_add(request, plane_id, plane_properties->crtc_w,
+				plane_setup->display_width,
+				plane_setup_old.display_width, force);
+	plane_property_diff_add(request, plane_id, plane_properties->crtc_h,
+				plane_setup->display_height,
+				plane_setup_old.display_height, force);
+	plane_property_diff_add(request, plane_id, plane_properties->crtc_x,
+				plane_setup->display_x,
+				plane_setup_old.display_x, force);
+	plane_property_diff_add(request, plane_id, plane_properties->crtc_y,
+				plane_setup->display_y,
+				plane_setup_old.display_y, force);
+
+	if (plane_properties->rotation)
+		plane_property_diff_add(request, plane_id,
+					plane_properties->rotation,
+					plane_setup->rotation,
+					plane_setup_old.rotation,
+					plane_setup_old.rotation_update);
+
+	plane_setup_composition_add(request, plane_setup);
+
+	plane_setup_updates_complete(plane_setup);
+	flags |= display_updates_add(display, request);
+
+	ret = request_commit(request, flags);
+	if (ret) {
+		ret = -errno;
+		goto error;
+	}
+
+	display_updates_complete(display);
+
+complete:
+	if (reallocate) {
+		for (i = 0; i < buffers_count; i++)
+			drm_display_buffer_teardown(display, &buffers[i]);
+
+		memcpy(buffers, buffers_new, buffers_count * sizeof(*buffers));
+
+		if (plane_setup->configured) {
+			plane_setup_visible_set(display, plane_setup,
+						&buffers[0]);
+			buffer_damage_reset(&buffers[0]);
+		}
+
+		if (buffers_index)
+			*buffers_index = plane_setup->configured ?
+					 1 % buffers_count : 0;
+	}
+
+	ret = 0;
+	goto free;
+
+error:
+	for (i = 0; i < buffers_count; i++)
+		if (buffers_new[i].fb_id)
+			drm_display_buffer_teardown(display, &buffers_new[i]);
+
+	memcpy(plane_setup, &plane_setup_old, sizeof(*plane_setup));
+
+free:
+	if (request)
+		request_free(request);
+
+	return ret;
+}
+
+int drm_display_takeover(struct drm_display *display,
+			 struct drm_display_buffer *buffer)
+{
+	struct drm_display_plane_setup *plane_setup;
+	struct drm_mode_map_dumb map_dumb = { 0 };
+	const struct drm_display_format *format;
+	drmModePlanePtr plane = NULL;
+	drmModeFB2Ptr fb = NULL;
+	void *map = MAP_FAILED;
+	unsigned int width, height;
+	unsigned int y;
+	size_t size = 0;
+	int ret;
+
+	if (!display || !buffer)
+		return -EINVAL;
+
+	plane_setup = &display->primary_setup;
+
+	/* Only an output that is already lit up can be taken over. */
+	if (!display->output.mode_set || plane_setup->configured)
+		return -EINVAL;
+
+	/*
+	 * Carry the current content over when possible, so that the switch
+	 * to our buffer goes unnoticed. This is best-effort and requires
+	 * the framebuffer handles, that are only exposed to the master.
+	 */
+	format = format_find(buffer->format);
+	if (!format || format->planes > 1 || !buffer->data[0])
+		goto configure;
+
+	plane = drmModeGetPlane(display->drm_fd, plane_setup->plane.id);
+	if (!plane || !plane->fb_id ||
+	    plane->crtc_id != display->output.crtc_id)
+		goto configure;
+
+	fb = drmModeGetFB2(display->drm_fd, plane->fb_id);
+	if (!fb || !fb->handles[0] || fb->pixel_format != buffer->format)
+		goto configure;
+
+	map_dumb.handle = fb->handles[0];
+
+	ret = drmIoctl(display->drm_fd, DRM_IOCTL_MODE_MAP_DUMB, &map_dumb);
+	if (ret)
+		goto configure;
+
+	size = fb->offsets[0] + fb->pitches[0] * fb->height;
+
+	map = mmap(0, size, PROT_READ, MAP_SHARED, display->drm_fd,
+		   map_dumb.offset);
+	if (map == MAP_FAILED)
+		goto configure;
+
+	width = fb->width < buffer->width ? fb->width : buffer->width;
+	height = fb->height < buffer->height ? fb->height : buffer->height;
+
+	for (y = 0; y < height; y++)
+		memcpy(buffer->data[0] + y * buffer->strides[0],
+		       map + fb->offsets[0] + y * fb->pitches[0],
+		       width * format->cpp[0]);
+
+	buffer->damage_set = false;
+
+configure:
+	if (map != MAP_FAILED)
+		munmap(map, size);
+
+	if (fb) {
+		if (fb->handles[0])
+			drmCloseBufferHandle(display->drm_fd, fb->handles[0]);
+
+		drmModeFreeFB2(fb);
+	}
+
+	if (plane)
+		drmModeFreePlane(plane);
+
+	return drm_display_configure(display, plane_setup, buffer);
+}
+
+bool drm_display_update_pending(struct drm_display *display)
+{
+	if (!display)
+		return false;
+
+	return display_updates_pending(display);
+}
 
-complete:
-	drmModeAtomicFree(request);
+int drm_display_update(struct drm_display *display)
+{
+	if (!display)
+		return -EINVAL;
 
-	return ret;
+	return display_updates_commit(display, 0);
 }
 
-int drm_display_configure(struct drm_display *display,
-			  struct drm_display_plane_setup *plane_setup,
-			  struct drm_display_buffer *buffer)
+static int writeback_setup(struct drm_display *display)
 {
-	drmModeAtomicReqPtr request;
-	struct drm_display_plane_properties *plane_properties;
-	struct drm_display_crtc_properties *crtc_properties;
-	struct drm_display_connector_properties *connector_properties;
-	uint32_t flags = 0;
-	uint32_t plane_id;
-	uint32_t crtc_id;
-	uint32_t connector_id;
+	struct drm_display_writeback *writeback = &display->writeback;
+	struct drm_display_plane_setup plane_setup = { 0 };
+	unsigned int i;
 	int ret;
 
-	if (!display || !buffer || !plane_setup)
+	if (!writeback->buffers_count)
+		writeback->buffers_count = 3;
+	else if (writeback->buffers_count > ARRAY_SIZE(writeback->buffers))
 		return -EINVAL;
 
-	plane_properties = &plane_setup->plane.properties;
-	plane_id = plane_setup->plane.id;
-
-	crtc_properties = &display->output.crtc_properties;
-	crtc_id = display->output.crtc_id;
+	plane_setup.buffer_width = writeback->buffer_width;
+	plane_setup.buffer_height = writeback->buffer_height;
+	plane_setup.buffer_format = writeback->buffer_format;
+	plane_setup.buffer_usage = writeback->buffer_usage;
 
-	connector_properties = &display->output.connector_properties;
-	connector_id = display->output.connector_id;
+	for (i = 0; i < writeback->buffers_count; i++) {
+		writeback->fences[i] = -1;
+		writeback->held[i] = false;
+	}
 
-	request = drmModeAtomicAlloc();
-	if (!request)
-		return -ENOMEM;
+	for (i = 0; i < writeback->buffers_count; i++) {
+		ret = drm_display_buffer_setup(display, &writeback->buffers[i],
+					       &plane_setup);
+		if (ret)
+			return ret;
+	}
 
-	if (!display->output.mode_set) {
-		drmModeCreatePropertyBlob(display->drm_fd,
-					  &display->output.mode,
-					  sizeof(display->output.mode),
-					  &display->output.mode_blob_id);
+	writeback->capture_index = 0;
+	writeback->complete_index = 0;
+	writeback->captures_count = 0;
 
-		drmModeAtomicAddProperty(request, connector_id,
-					 connector_properties->crtc_id,
-					 crtc_id);
+	return 0;
+}
 
-		drmModeAtomicAddProperty(request, crtc_id,
-					 crtc_properties->active, 1);
-		drmModeAtomicAddProperty(request, crtc_id,
-					 crtc_properties->mode_id,
-					 display->output.mode_blob_id);
+static void writeback_teardown(struct drm_display *display)
+{
+	struct drm_display_writeback *writeback = &display->writeback;
+	struct drm_display_writeback_properties *properties =
+		&writeback->properties;
+	struct drm_display_request *request;
+	unsigned int i;
 
-		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
-	}
+	if (writeback->attached) {
+		request = request_alloc(display);
+		if (request) {
+			request_property_add(request,
+					     writeback->connector_id,
+					     properties->crtc_id, 0);
+			request_property_add(request,
+					     writeback->connector_id,
+					     properties->fb_id, 0);
+
+			request_commit(request, DRM_MODE_ATOMIC_ALLOW_MODESET);
+			request_free(request);
+		}
 
-	drmModeAtomicAddProperty(request, plane_id, plane_properties->fb_id,
-				 buffer->fb_id);
-	drmModeAtomicAddProperty(request, plane_id, plane_properties->crtc_id,
-				 display->output.crtc_id);
-
-	drmModeAtomicAddProperty(request, plane_id, plane_properties->src_w,
-				 plane_setup->buffer_width << 16);
-	drmModeAtomicAddProperty(request, plane_id, plane_properties->src_h,
-				 plane_setup->buffer_height << 16);
-	drmModeAtomicAddProperty(request, plane_id, plane_properties->src_x, 0);
-	drmModeAtomicAddProperty(request, plane_id, plane_properties->src_y, 0);
-
-	drmModeAtomicAddProperty(request, plane_id, plane_properties->crtc_w,
-				 plane_setup->display_width);
-	drmModeAtomicAddProperty(request, plane_id, plane_properties->crtc_h,
-				 plane_setup->display_height);
-	drmModeAtomicAddProperty(request, plane_id, plane_properties->crtc_x,
-				 plane_setup->display_x);
-	drmModeAtomicAddProperty(request, plane_id, plane_properties->crtc_y,
-				 plane_setup->display_y);
-
-	ret = drmModeAtomicCommit(display->drm_fd, request, flags, NULL);
-	if (ret) {
-		ret = -errno;
-		goto complete;
+		writeback->attached = false;
 	}
 
-	plane_setup->buffer_visible = buffer;
-	plane_setup->configured = true;
+	for (i = 0; i < writeback->buffers_count; i++) {
+		if (writeback->fences[i] >= 0)
+			close(writeback->fences[i]);
 
-	if (!display->output.mode_set)
-		display->output.mode_set = true;
+		writeback->fences[i] = -1;
+		writeback->held[i] = false;
 
-complete:
-	drmModeAtomicFree(request);
+		if (writeback->buffers[i].fb_id)
+			drm_display_buffer_teardown(display,
+						    &writeback->buffers[i]);
+	}
 
-	return ret;
+	writeback->capture_update = false;
+	writeback->captures_count = 0;
 }
 
 int drm_display_setup(struct drm_display *display)
@@ -382,7 +3271,13 @@ int drm_display_setup(struct drm_display *display)
 	if (!display || display->up)
 		return -EINVAL;
 
-	display->primary_buffers_count = ARRAY_SIZE(display->primary_buffers);
+	/* Double-buffering is used unless more buffers were requested. */
+	if (!display->primary_buffers_count)
+		display->primary_buffers_count = 2;
+	else if (display->primary_buffers_count >
+		 ARRAY_SIZE(display->primary_buffers))
+		return -EINVAL;
+
 	display->primary_buffers_index = 0;
 
 	for (i = 0; i < display->primary_buffers_count; i++) {
@@ -395,18 +3290,36 @@ int drm_display_setup(struct drm_display *display)
 			goto error;
 	}
 
-	if (!display->primary_setup.display_width ||
-	    !display->primary_setup.display_height) {
-		display->primary_setup.display_width =
-			display->primary_setup.buffer_width;
-		display->primary_setup.display_height =
-			display->primary_setup.buffer_height;
+	plane_setup_dimensions(&display->primary_setup);
+
+	if (display->cursor_setup.buffer_format &&
+	    display->cursor_setup.plane.id) {
+		ret = drm_display_buffer_setup(display, &display->cursor_buffer,
+					       &display->cursor_setup);
+		if (ret)
+			goto error;
+
+		plane_setup_dimensions(&display->cursor_setup);
+	}
+
+	if (display->writeback.buffer_format &&
+	    display->writeback.connector_id) {
+		ret = writeback_setup(display);
+		if (ret)
+			goto error;
 	}
 
 	if (!display->overlay_setup.buffer_format)
 		goto complete;
 
-	display->overlay_buffers_count = ARRAY_SIZE(display->overlay_buffers);
+	if (!display->overlay_buffers_count)
+		display->overlay_buffers_count = 2;
+	else if (display->overlay_buffers_count >
+		 ARRAY_SIZE(display->overlay_buffers)) {
+		ret = -EINVAL;
+		goto error;
+	}
+
 	display->overlay_buffers_index = 0;
 
 	for (i = 0; i < display->overlay_buffers_count; i++) {
@@ -419,13 +3332,7 @@ int drm_display_setup(struct drm_display *display)
 			goto error;
 	}
 
-	if (!display->overlay_setup.display_width ||
-	    !display->overlay_setup.display_height) {
-		display->overlay_setup.display_width =
-			display->overlay_setup.buffer_width;
-		display->overlay_setup.display_height =
-			display->overlay_setup.buffer_height;
-	}
+	plane_setup_dimensions(&display->overlay_setup);
 
 complete:
 	display->up = true;
@@ -433,9 +3340,24 @@ complete:
 	return 0;
 
 error:
-	/* TODO: teardown created buffers. */
+	for (i = 0; i < ARRAY_SIZE(display->primary_buffers); i++)
+		if (display->primary_buffers[i].fb_id)
+			drm_display_buffer_teardown(display,
+						    &display->primary_buffers[i]);
 
-	return -1;
+	if (display->cursor_buffer.fb_id)
+		drm_display_buffer_teardown(display, &display->cursor_buffer);
+
+	/* Fences are only initialised once writeback buffers exist. */
+	if (display->writeback.buffers[0].fb_id)
+		writeback_teardown(display);
+
+	for (i = 0; i < ARRAY_SIZE(display->overlay_buffers); i++)
+		if (display->overlay_buffers[i].fb_id)
+			drm_display_buffer_teardown(display,
+						    &display->overlay_buffers[i]);
+
+	return ret;
 }
 
 int drm_display_teardown(struct drm_display *display)
@@ -445,6 +3367,22 @@ int drm_display_teardown(struct drm_display *display)
 	if (!display || !display->up)
 		return -EINVAL;
 
+	/*
+	 * The CRTC keeps its own reference to colour blobs, reset them so
+	 * that the next client or the console does not inherit them.
+	 */
+	if (display->output.gamma_lut_blob_id ||
+	    display->output.degamma_lut_blob_id ||
+	    display->output.ctm_blob_id) {
+		color_blob_replace(display, &display->output.gamma_lut_blob_id,
+				   0);
+		color_blob_replace(display,
+				   &display->output.degamma_lut_blob_id, 0);
+		color_blob_replace(display, &display->output.ctm_blob_id, 0);
+
+		display_updates_commit(display, 0);
+	}
+
 	if (display->primary_setup.configured)
 		drm_display_detach(display, &display->primary_setup);
 
@@ -465,12 +3403,25 @@ int drm_display_teardown(struct drm_display *display)
 		drm_display_buffer_teardown(display, buffer);
 	}
 
+	if (display->cursor_setup.configured)
+		drm_display_detach(display, &display->cursor_setup);
+
+	if (display->cursor_buffer.fb_id)
+		drm_display_buffer_teardown(display, &display->cursor_buffer);
+
+	if (display->writeback.connector_id)
+		writeback_teardown(display);
+
+	fb_cache_flush(display);
+
 	if (display->output.mode_blob_id) {
 		drmModeDestroyPropertyBlob(display->drm_fd,
 					   display->output.mode_blob_id);
 		display->output.mode_blob_id = 0;
 	}
 
+	display->output.color_update = false;
+
 	display->up = false;
 
 	return 0;
@@ -515,7 +3466,8 @@ static int display_properties_probe(struct drm_display *display,
 	}
 
 	for (i = 0; i < display_properties_count; i++)
-		if (!*display_properties[i].id)
+		if (!*display_properties[i].id &&
+		    !display_properties[i].optional)
 			goto error;
 
 	ret = 0;
@@ -546,6 +3498,110 @@ static int connector_properties_probe(struct drm_display *display)
 					ARRAY_SIZE(display_properties));
 }
 
+static int writeback_properties_probe(struct drm_display *display)
+{
+	struct drm_display_writeback_properties *writeback_properties =
+		&display->writeback.properties;
+	struct drm_display_property display_properties[] = {
+		{ "CRTC_ID",	&writeback_properties->crtc_id },
+		{ "WRITEBACK_FB_ID",	&writeback_properties->fb_id },
+		{ "WRITEBACK_OUT_FENCE_PTR",
+				&writeback_properties->out_fence_ptr },
+		{ "WRITEBACK_PIXEL_FORMATS",
+				&writeback_properties->pixel_formats,
+				&display->writeback.pixel_formats_blob_id },
+	};
+
+	return display_properties_probe(display, display->writeback.connector_id,
+					DRM_MODE_OBJECT_CONNECTOR,
+					(struct drm_display_property *)&display_properties,
+					ARRAY_SIZE(display_properties));
+}
+
+static int writeback_probe(struct drm_display *display,
+			   drmModeResPtr resources, unsigned int crtc_index)
+{
+	struct drm_display_writeback *writeback = &display->writeback;
+	drmModePropertyBlobPtr blob;
+	uint32_t *formats;
+	unsigned int count;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < resources->count_connectors; i++) {
+		drmModeConnectorPtr connector;
+		drmModeEncoderPtr encoder;
+		bool found = false;
+
+		connector = drmModeGetConnector(display->drm_fd,
+						resources->connectors[i]);
+		if (!connector)
+			continue;
+
+		if (connector->connector_type != DRM_MODE_CONNECTOR_WRITEBACK ||
+		    !connector->count_encoders)
+			goto next_connector;
+
+		encoder = drmModeGetEncoder(display->drm_fd,
+					    connector->encoders[0]);
+		if (!encoder)
+			goto next_connector;
+
+		if (encoder->possible_crtcs & (1 << crtc_index)) {
+			writeback->connector_id = connector->connector_id;
+			found = true;
+		}
+
+		drmModeFreeEncoder(encoder);
+
+next_connector:
+		drmModeFreeConnector(connector);
+
+		if (found)
+			break;
+	}
+
+	if (!writeback->connector_id)
+		return -ENODEV;
+
+	ret = writeback_properties_probe(display);
+	if (ret)
+		goto error;
+
+	blob = drmModeGetPropertyBlob(display->drm_fd,
+				      writeback->pixel_formats_blob_id);
+	if (!blob) {
+		ret = -errno;
+		goto error;
+	}
+
+	formats = blob->data;
+	count = blob->length / sizeof(*formats);
+
+	for (i = 0; i < count; i++)
+		if (formats[i] == writeback->buffer_format)
+			break;
+
+	drmModeFreePropertyBlob(blob);
+
+	if (i == count) {
+		ret = -EINVAL;
+		goto error;
+	}
+
+	if (!writeback->buffer_width || !writeback->buffer_height) {
+		writeback->buffer_width = display->output.mode.hdisplay;
+		writeback->buffer_height = display->output.mode.vdisplay;
+	}
+
+	return 0;
+
+error:
+	writeback->connector_id = 0;
+
+	return ret;
+}
+
 static int crtc_properties_probe(struct drm_display *display)
 {
 
@@ -554,6 +3610,13 @@ static int crtc_properties_probe(struct drm_display *display)
 	struct drm_display_property display_properties[] = {
 		{ "ACTIVE",	&crtc_properties->active },
 		{ "MODE_ID",	&crtc_properties->mode_id },
+		{ "GAMMA_LUT",	&crtc_properties->gamma_lut, NULL, true },
+		{ "GAMMA_LUT_SIZE",	&crtc_properties->gamma_lut_size,
+					&display->output.gamma_lut_size, true },
+		{ "DEGAMMA_LUT",	&crtc_properties->degamma_lut, NULL, true },
+		{ "DEGAMMA_LUT_SIZE",	&crtc_properties->degamma_lut_size,
+					&display->output.degamma_lut_size, true },
+		{ "CTM",	&crtc_properties->ctm, NULL, true },
 	};
 
 	return display_properties_probe(display, display->output.crtc_id,
@@ -562,6 +3625,72 @@ static int crtc_properties_probe(struct drm_display *display)
 					ARRAY_SIZE(display_properties));
 }
 
+static void plane_features_probe(struct drm_display *display,
+				    struct drm_display_plane *plane)
+{
+	struct drm_display_plane_properties *plane_properties =
+		&plane->properties;
+	const char *blend_mode_names[] = {
+		[DRM_DISPLAY_BLEND_PREMULTIPLIED] = "Pre-multiplied",
+		[DRM_DISPLAY_BLEND_COVERAGE] = "Coverage",
+		[DRM_DISPLAY_BLEND_NONE] = "None",
+	};
+	drmModePropertyPtr property;
+	unsigned int i, j;
+
+	if (plane_properties->rotation) {
+		property = drmModeGetProperty(display->drm_fd,
+					      plane_properties->rotation);
+		if (property) {
+			/* Bitmask enum values are bit indices. */
+			for (i = 0; i < property->count_enums; i++)
+				if (property->enums[i].value < 32)
+					plane->rotations |=
+						1 << property->enums[i].value;
+
+			drmModeFreeProperty(property);
+		}
+	}
+
+	if (plane_properties->zpos) {
+		property = drmModeGetProperty(display->drm_fd,
+					      plane_properties->zpos);
+		if (property) {
+			plane->zpos_immutable =
+				property->flags & DRM_MODE_PROP_IMMUTABLE;
+
+			if (property->count_values == 2) {
+				plane->zpos_min = property->values[0];
+				plane->zpos_max = property->values[1];
+			}
+
+			drmModeFreeProperty(property);
+		}
+	}
+
+	if (!plane_properties->pixel_blend_mode)
+		return;
+
+	property = drmModeGetProperty(display->drm_fd,
+				      plane_properties->pixel_blend_mode);
+	if (!property)
+		return;
+
+	/* Enum values are driver-specific, only their names are standard. */
+	for (i = 0; i < property->count_enums; i++) {
+		for (j = 0; j < ARRAY_SIZE(blend_mode_names); j++) {
+			if (strcmp(property->enums[i].name,
+				   blend_mode_names[j]))
+				continue;
+
+			plane->blend_modes[j] = property->enums[i].value;
+			plane->blend_modes_supported |= 1 << j;
+		}
+	}
+
+	drmModeFreeProperty(property);
+}
+
 static int plane_properties_probe(struct drm_display *display,
 				  struct drm_display_plane *plane)
 {
@@ -579,22 +3708,132 @@ static int plane_properties_probe(struct drm_display *display,
 		{ "CRTC_Y",	&plane_properties->crtc_y },
 		{ "CRTC_W",	&plane_properties->crtc_w },
 		{ "CRTC_H",	&plane_properties->crtc_h },
+		{ "zpos",	&plane_properties->zpos, NULL, true },
+		{ "alpha",	&plane_properties->alpha, NULL, true },
+		{ "pixel blend mode",	&plane_properties->pixel_blend_mode,
+					NULL, true },
+		{ "rotation",	&plane_properties->rotation, NULL, true },
 	};
+	int ret;
 
-	return display_properties_probe(display, plane->id,
-					DRM_MODE_OBJECT_PLANE,
-					(struct drm_display_property *)&display_properties,
-					ARRAY_SIZE(display_properties));
+	ret = display_properties_probe(display, plane->id,
+				       DRM_MODE_OBJECT_PLANE,
+				       (struct drm_display_property *)&display_properties,
+				       ARRAY_SIZE(display_properties));
+	if (ret)
+		return ret;
+
+	plane_features_probe(display, plane);
+
+	return 0;
+}
+
+/*
+ * A CRTC is busy when this display leased it out or when it drives another
+ * connector, which is only read back and never probed again here.
+ */
+static bool crtc_busy(struct drm_display *display, drmModeResPtr resources,
+		      drmModeConnectorPtr connector, uint32_t crtc_id)
+{
+	drmModeConnectorPtr other;
+	drmModeEncoderPtr encoder;
+	bool busy = false;
+	unsigned int i;
+
+	for (i = 0; i < display->leased_crtcs_count; i++)
+		if (display->leased_crtc_ids[i] == crtc_id)
+			return true;
+
+	for (i = 0; i < resources->count_connectors && !busy; i++) {
+		if (resources->connectors[i] == connector->connector_id)
+			continue;
+
+		other = drmModeGetConnectorCurrent(display->drm_fd,
+						   resources->connectors[i]);
+		if (!other)
+			continue;
+
+		if (other->encoder_id) {
+			encoder = drmModeGetEncoder(display->drm_fd,
+						    other->encoder_id);
+			if (encoder) {
+				busy = encoder->crtc_id == crtc_id;
+				drmModeFreeEncoder(encoder);
+			}
+		}
+
+		drmModeFreeConnector(other);
+	}
+
+	return busy;
+}
+
+/*
+ * A lessee only sees the objects it was leased, so the CRTC is picked among
+ * the listed ones and encoders that cannot reach any of them are skipped.
+ */
+static uint32_t connector_crtc_find(struct drm_display *display,
+				    drmModeResPtr resources,
+				    drmModeConnectorPtr connector,
+				    unsigned int *crtc_index)
+{
+	drmModeEncoderPtr encoder;
+	uint32_t crtc_id = 0;
+	unsigned int i, j;
+
+	/* Keep the CRTC currently driving the connector when visible. */
+	if (connector->encoder_id) {
+		encoder = drmModeGetEncoder(display->drm_fd,
+					    connector->encoder_id);
+		if (encoder) {
+			for (i = 0; i < resources->count_crtcs; i++) {
+				if (encoder->crtc_id &&
+				    resources->crtcs[i] == encoder->crtc_id &&
+				    !crtc_busy(display, resources, connector,
+					       encoder->crtc_id)) {
+					crtc_id = encoder->crtc_id;
+					*crtc_index = i;
+					break;
+				}
+			}
+
+			drmModeFreeEncoder(encoder);
+		}
+
+		if (crtc_id)
+			return crtc_id;
+	}
+
+	for (j = 0; j < connector->count_encoders && !crtc_id; j++) {
+		encoder = drmModeGetEncoder(display->drm_fd,
+					    connector->encoders[j]);
+		if (!encoder)
+			continue;
+
+		for (i = 0; i < resources->count_crtcs; i++) {
+			if ((encoder->possible_crtcs & (1 << i)) &&
+			    !crtc_busy(display, resources, connector,
+				       resources->crtcs[i])) {
+				crtc_id = resources->crtcs[i];
+				*crtc_index = i;
+				break;
+			}
+		}
+
+		drmModeFreeEncoder(encoder);
+	}
+
+	return crtc_id;
 }
 
 int drm_display_probe(struct drm_display *display)
 {
 	drmModeResPtr resources = NULL;
 	drmModePlaneResPtr plane_resources = NULL;
-	drmModeEncoderPtr encoder = NULL;
 	drmModeCrtcPtr crtc = NULL;
 	drmModeModeInfo mode_best = { 0 };
-	uint32_t encoder_id = 0;
+	uint32_t connector_id;
+	bool writeback = false;
 	unsigned int crtc_index = 0;
 	unsigned int i, j;
 	int ret;
@@ -613,31 +3852,46 @@ int drm_display_probe(struct drm_display *display)
 	if (ret)
 		return -errno;
 
+	/* Writeback connectors are optional, and never leased. */
+	if (display->writeback.buffer_format) {
+		ret = drmSetClientCap(display->drm_fd,
+				      DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1);
+		if (!ret)
+			writeback = true;
+	}
+
 	/* Get DRM resources. */
 
 	resources = drmModeGetResources(display->drm_fd);
 	if (!resources)
 		return -ENODEV;
 
-	/* Find a connected connector. */
+	/* Find a connected connector that a CRTC can drive. */
+
+	connector_id = display->output.connector_id;
+	display->output.crtc_id = 0;
 
 	for (i = 0; i < resources->count_connectors; i++) {
 		drmModeConnectorPtr connector;
 
+		/* Stick to the connector that was asked for, if any. */
+		if (connector_id && resources->connectors[i] != connector_id)
+			continue;
+
 		/* Fully probe the connector in case it was not yet configured. */
 		connector = drmModeGetConnector(display->drm_fd,
 						resources->connectors[i]);
 		if (!connector)
 			continue;
 
-		if (connector->connection != DRM_MODE_CONNECTED)
+		if (connector->connection != DRM_MODE_CONNECTED ||
+		    connector->connector_type == DRM_MODE_CONNECTOR_WRITEBACK)
 			goto next_connector;
 
-		if (connector->encoder_id)
-			encoder_id = connector->encoder_id;
-		else if (connector->count_encoders)
-			encoder_id = connector->encoders[0];
-		else
+		display->output.crtc_id = connector_crtc_find(display, resources,
+							      connector,
+							      &crtc_index);
+		if (!display->output.crtc_id)
 			goto next_connector;
 
 		display->output.connector_id = connector->connector_id;
@@ -653,52 +3907,17 @@ int drm_display_probe(struct drm_display *display)
 next_connector:
 		drmModeFreeConnector(connector);
 
-		if (encoder_id)
+		if (display->output.crtc_id)
 			break;
 	}
 
-	if (i == resources->count_connectors)
+	if (!display->output.crtc_id)
 		goto error;
 
 	ret = connector_properties_probe(display);
 	if (ret)
 		goto error;
 
-	/* Find the attached CRTC ID. */
-
-	encoder = drmModeGetEncoder(display->drm_fd, encoder_id);
-	if (!encoder)
-		goto error;
-
-	if (encoder->crtc_id) {
-		display->output.crtc_id = encoder->crtc_id;
-	} else for (i = 0; i < resources->count_crtcs; i++) {
-		uint32_t crtc_mask = 1 << i;
-
-		if (encoder->possible_crtcs & crtc_mask) {
-			display->output.crtc_id = resources->crtcs[i];
-			break;
-		}
-	}
-
-	if (!display->output.crtc_id)
-		goto error;
-
-	drmModeFreeEncoder(encoder);
-	encoder = NULL;
-
-	/* Find the CRTC index. */
-
-	for (i = 0; i < resources->count_crtcs; i++) {
-		if (resources->crtcs[i] == display->output.crtc_id) {
-			crtc_index = i;
-			break;
-		}
-	}
-
-	if (i == resources->count_crtcs)
-		goto error;
-
 	crtc = drmModeGetCrtc(display->drm_fd, display->output.crtc_id);
 	if (!crtc)
 		goto error;
@@ -717,6 +3936,10 @@ next_connector:
 	if (ret)
 		goto error;
 
+	/* Writeback is optional, like overlay planes. */
+	if (writeback)
+		writeback_probe(display, resources, crtc_index);
+
 	/* Get plane resources. */
 
 	plane_resources = drmModeGetPlaneResources(display->drm_fd);
@@ -756,6 +3979,12 @@ next_connector:
 
 			format = display->overlay_setup.buffer_format;
 			break;
+		case DRM_PLANE_TYPE_CURSOR:
+			if (display->cursor_setup.plane.id)
+				goto next_plane;
+
+			format = display->cursor_setup.buffer_format;
+			break;
 		default:
 			goto next_plane;
 		}
@@ -776,18 +4005,40 @@ next_connector:
 			memcpy(&display->overlay_setup.plane, &display_plane,
 			       sizeof(display->overlay_setup.plane));
 			break;
+		case DRM_PLANE_TYPE_CURSOR:
+			memcpy(&display->cursor_setup.plane, &display_plane,
+			       sizeof(display->cursor_setup.plane));
+			break;
 		}
 
 next_plane:
 		drmModeFreePlane(plane);
 
-		if (display->primary_setup.plane.id)
+		if (display->primary_setup.plane.id &&
+		    (!display->overlay_setup.buffer_format ||
+		     display->overlay_setup.plane.id) &&
+		    (!display->cursor_setup.buffer_format ||
+		     display->cursor_setup.plane.id))
 			break;
 	}
 
-	if (i == plane_resources->count_planes)
+	if (!display->primary_setup.plane.id)
 		goto error;
 
+	if (display->cursor_setup.plane.id &&
+	    (!display->cursor_setup.buffer_width ||
+	     !display->cursor_setup.buffer_height)) {
+		uint64_t cursor_width = 64;
+		uint64_t cursor_height = 64;
+
+		drmGetCap(display->drm_fd, DRM_CAP_CURSOR_WIDTH, &cursor_width);
+		drmGetCap(display->drm_fd, DRM_CAP_CURSOR_HEIGHT,
+			  &cursor_height);
+
+		display->cursor_setup.buffer_width = cursor_width;
+		display->cursor_setup.buffer_height = cursor_height;
+	}
+
 	if (!display->primary_setup.buffer_width ||
 	    !display->primary_setup.buffer_height) {
 		display->primary_setup.buffer_width =
@@ -803,9 +4054,6 @@ error:
 	ret = -1;
 
 complete:
-	if (encoder)
-		drmModeFreeEncoder(encoder);
-
 	if (crtc)
 		drmModeFreeCrtc(crtc);
 
@@ -906,6 +4154,18 @@ complete:
 	return ret;
 }
 
+int drm_display_open_fd(struct drm_display *display, int fd)
+{
+	if (!display || fd < 0)
+		return -EINVAL;
+
+	/* Lessees get their device file from the lessor, not from udev. */
+	display->drm_path = drmGetDeviceNameFromFd2(fd);
+	display->drm_fd = fd;
+
+	return 0;
+}
+
 void drm_display_close(struct drm_display *display)
 {
 	if (!display)
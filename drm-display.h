@@ -9,12 +9,29 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <cairo.h>
 #include <drm_fourcc.h>
 #include <xf86drmMode.h>
 #include <xf86drm.h>
 
 struct drm_display;
 
+struct drm_display_rect {
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+};
+
+enum drm_display_buffer_usage {
+	/* Mapped for CPU access for the whole buffer lifetime. */
+	DRM_DISPLAY_BUFFER_USAGE_CPU = 0,
+	/* Filled by a device, only mapped while accessed by the CPU. */
+	DRM_DISPLAY_BUFFER_USAGE_DEVICE,
+	/* Exported as dma-buf, only mapped while accessed by the CPU. */
+	DRM_DISPLAY_BUFFER_USAGE_EXPORT,
+};
+
 struct drm_display_buffer {
 	unsigned int width;
 	unsigned int height;
@@ -28,12 +45,39 @@ struct drm_display_buffer {
 	uint32_t sizes[4];
 
 	void *data[4];
+
+	enum drm_display_buffer_usage usage;
+
+	/* Scanout mapping, data points to the cached shadow copy if any. */
+	void *map;
+	unsigned int map_count;
+	void *shadow;
+
+	int dma_buf_fd;
+
+	cairo_surface_t *cairo_surface;
+	cairo_t *cairo;
+
+	/* Region changed since the buffer was last shown, full when not set. */
+	struct drm_display_rect damage;
+	bool damage_set;
+
+	/* Content hash of each block of rows, kept for incremental updates. */
+	uint32_t *hash_blocks;
+	unsigned int hash_blocks_count;
+	bool hash_valid;
+	bool hash_clean;
+
+	/* Imported from a dma-buf, kept while referenced or cached. */
+	bool imported;
+	unsigned int references;
 };
 
 struct drm_display_property {
 	const char *name;
 	uint32_t *id;
 	uint32_t *value;
+	bool optional;
 };
 
 struct drm_display_connector_properties {
@@ -43,6 +87,11 @@ struct drm_display_connector_properties {
 struct drm_display_crtc_properties {
 	uint32_t active;
 	uint32_t mode_id;
+	uint32_t gamma_lut;
+	uint32_t gamma_lut_size;
+	uint32_t degamma_lut;
+	uint32_t degamma_lut_size;
+	uint32_t ctm;
 };
 
 struct drm_display_plane_properties {
@@ -57,32 +106,155 @@ struct drm_display_plane_properties {
 	uint32_t crtc_h;
 	uint32_t crtc_x;
 	uint32_t crtc_y;
+	uint32_t zpos;
+	uint32_t alpha;
+	uint32_t pixel_blend_mode;
+	uint32_t rotation;
+};
+
+enum drm_display_blend_mode {
+	DRM_DISPLAY_BLEND_PREMULTIPLIED = 0,
+	DRM_DISPLAY_BLEND_COVERAGE,
+	DRM_DISPLAY_BLEND_NONE,
 };
 
 struct drm_display_plane {
 	uint32_t id;
 	uint32_t type;
 
+	/* Stacking range, fixed by the hardware when immutable. */
+	uint64_t zpos_min;
+	uint64_t zpos_max;
+	bool zpos_immutable;
+
+	/* Pixel blend mode property values, valid for supported modes. */
+	uint64_t blend_modes[3];
+	unsigned int blend_modes_supported;
+
+	/* Supported DRM_MODE_ROTATE_* and DRM_MODE_REFLECT_* bits. */
+	uint32_t rotations;
+
 	struct drm_display_plane_properties properties;
 };
 
+struct drm_display_dynamic_resolution {
+	bool enabled;
+
+	/* Render time budget, derived from the mode refresh rate if unset. */
+	unsigned int budget_us;
+
+	/* Source scale relative to the buffer size, in per-mille. */
+	unsigned int scale;
+	unsigned int scale_min;
+};
+
 struct drm_display_plane_setup {
 	struct drm_display_plane plane;
 
 	struct drm_display_buffer *buffer_visible;
+	/* Staged by drm_display_page_flip_stage(), sent with the next commit. */
+	struct drm_display_buffer *buffer_pending;
 
 	unsigned int buffer_width;
 	unsigned int buffer_height;
 	uint32_t buffer_format;
+	enum drm_display_buffer_usage buffer_usage;
+	bool buffer_shadow;
+
+	unsigned int source_width;
+	unsigned int source_height;
+	unsigned int source_x;
+	unsigned int source_y;
+	bool source_update;
+
+	struct drm_display_dynamic_resolution dynamic_resolution;
 
 	unsigned int display_width;
 	unsigned int display_height;
-	unsigned int display_x;
-	unsigned int display_y;
+	int display_x;
+	int display_y;
+	bool display_update;
+
+	/* Applied to the source rectangle, as DRM_MODE_ROTATE_* bits. */
+	uint32_t rotation;
+	bool rotation_update;
+
+	/* Composition by the display controller, sent once set. */
+	uint64_t zpos;
+	uint16_t alpha;
+	enum drm_display_blend_mode blend_mode;
+	bool zpos_update;
+	bool alpha_update;
+	bool blend_mode_update;
 
 	bool configured;
 };
 
+struct drm_display_writeback_properties {
+	uint32_t crtc_id;
+	uint32_t fb_id;
+	uint32_t out_fence_ptr;
+	uint32_t pixel_formats;
+};
+
+/*
+ * Captures of the composited output run as a ring: a buffer handed out by
+ * drm_display_writeback_wait() is only captured to again once released.
+ */
+struct drm_display_writeback {
+	uint32_t connector_id;
+	struct drm_display_writeback_properties properties;
+	uint32_t pixel_formats_blob_id;
+
+	unsigned int buffer_width;
+	unsigned int buffer_height;
+	uint32_t buffer_format;
+	enum drm_display_buffer_usage buffer_usage;
+
+	struct drm_display_buffer buffers[4];
+	unsigned int buffers_count;
+	int fences[4];
+	bool held[4];
+
+	unsigned int capture_index;
+	unsigned int complete_index;
+	unsigned int captures_count;
+
+	int32_t out_fence;
+	bool capture_update;
+	bool attached;
+};
+
+struct drm_display_fb_cache_entry {
+	struct drm_display_buffer buffer;
+
+	/* Identity of the dma-buf, held alive by the imported handle. */
+	uint64_t device;
+	uint64_t inode;
+
+	uint64_t serial;
+	bool used;
+};
+
+struct drm_display_fb_cache_stats {
+	unsigned int lookups;
+	unsigned int hits;
+	unsigned int evictions;
+	unsigned int ioctls;
+};
+
+/*
+ * Framebuffers of imported dma-bufs, kept when unreferenced up to capacity
+ * and evicted least recently used first. A capacity of zero disables caching.
+ */
+struct drm_display_fb_cache {
+	struct drm_display_fb_cache_entry entries[16];
+	unsigned int capacity;
+	uint64_t serial;
+
+	struct drm_display_fb_cache_stats stats;
+};
+
 struct drm_display_output {
 	drmModeModeInfo mode;
 	uint32_t mode_blob_id;
@@ -93,6 +265,60 @@ struct drm_display_output {
 
 	uint32_t crtc_id;
 	struct drm_display_crtc_properties crtc_properties;
+
+	uint32_t gamma_lut_size;
+	uint32_t gamma_lut_blob_id;
+	uint32_t degamma_lut_size;
+	uint32_t degamma_lut_blob_id;
+	uint32_t ctm_blob_id;
+	bool color_update;
+};
+
+enum drm_display_idle_policy {
+	/* Skip flips to the visible buffer when it was not damaged. */
+	DRM_DISPLAY_IDLE_SKIP = 0,
+	/* Always commit flips. */
+	DRM_DISPLAY_IDLE_COMMIT,
+	/* Also skip flips to other buffers reported without damage. */
+	DRM_DISPLAY_IDLE_STOP,
+};
+
+struct drm_display_stats {
+	unsigned int flips_committed;
+	unsigned int flips_skipped;
+	unsigned int flips_coalesced;
+	unsigned int cursor_moves_committed;
+	unsigned int cursor_moves_folded;
+};
+
+struct drm_display_commit_item {
+	uint32_t object_id;
+	uint32_t property_id;
+	uint64_t value;
+};
+
+/* Buffer shown by a commit, since FB IDs are reused once removed. */
+struct drm_display_commit_buffer {
+	uint32_t fb_id;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+};
+
+/* Atomic commit as submitted, passed to the commit hook. */
+struct drm_display_commit {
+	const struct drm_display_commit_item *items;
+	unsigned int items_count;
+	const struct drm_display_commit_buffer *buffers;
+	unsigned int buffers_count;
+	uint32_t flags;
+
+	/* Some properties or buffers of the commit are missing from the copy. */
+	bool truncated;
+
+	uint64_t time_us;
+	uint64_t duration_us;
+	int result;
 };
 
 struct drm_display {
@@ -100,17 +326,36 @@ struct drm_display {
 	int drm_fd;
 
 	struct drm_display_output output;
+	struct drm_display_writeback writeback;
 
 	struct drm_display_plane_setup primary_setup;
-	struct drm_display_buffer primary_buffers[2];
+	struct drm_display_buffer primary_buffers[4];
 	unsigned int primary_buffers_count;
 	unsigned int primary_buffers_index;
 
 	struct drm_display_plane_setup overlay_setup;
-	struct drm_display_buffer overlay_buffers[2];
+	struct drm_display_buffer overlay_buffers[4];
 	unsigned int overlay_buffers_count;
 	unsigned int overlay_buffers_index;
 
+	struct drm_display_plane_setup cursor_setup;
+	struct drm_display_buffer cursor_buffer;
+
+	struct drm_display_fb_cache fb_cache;
+
+	/* CRTCs leased out to other masters, skipped when probing. */
+	uint32_t leased_crtc_ids[4];
+	unsigned int leased_crtcs_count;
+
+	enum drm_display_idle_policy idle_policy;
+	struct drm_display_stats stats;
+
+	/* Called after each atomic commit, with its properties. */
+	void (*commit_hook)(struct drm_display *display,
+			    const struct drm_display_commit *commit,
+			    void *private);
+	void *commit_hook_private;
+
 	bool up;
 
 	void *private;
@@ -118,21 +363,104 @@ struct drm_display {
 
 struct drm_display_buffer *drm_display_primary_buffer_cycle(struct drm_display *display);
 struct drm_display_buffer *drm_display_overlay_buffer_cycle(struct drm_display *display);
+void drm_display_buffer_damage(struct drm_display_buffer *buffer,
+				unsigned int x, unsigned int y,
+				unsigned int width, unsigned int height);
+void drm_display_buffer_damage_clear(struct drm_display_buffer *buffer);
+void drm_display_buffer_damage_full(struct drm_display_buffer *buffer);
+cairo_t *drm_display_buffer_cairo(struct drm_display_buffer *buffer);
+int drm_display_buffer_fill(struct drm_display_buffer *buffer,
+			    const struct drm_display_rect *rect,
+			    uint32_t color);
+int drm_display_buffer_hash(struct drm_display_buffer *buffer,
+			    uint32_t *hash);
+int drm_display_buffer_rotate(struct drm_display_buffer *destination,
+			      const struct drm_display_buffer *source,
+			      uint32_t rotation);
+int drm_display_buffer_map(struct drm_display *display,
+			   struct drm_display_buffer *buffer);
+int drm_display_buffer_unmap(struct drm_display *display,
+			     struct drm_display_buffer *buffer);
 int drm_display_buffer_dma_buf_export(struct drm_display *display,
 				      struct drm_display_buffer *buffer,
 				      int *fd);
+struct drm_display_buffer *drm_display_buffer_import(struct drm_display *display,
+						      int fd, unsigned int width,
+						      unsigned int height,
+						      uint32_t format,
+						      const uint32_t *strides,
+						      const uint32_t *offsets);
+int drm_display_buffer_release(struct drm_display *display,
+			       struct drm_display_buffer *buffer);
+int drm_display_buffer_setup(struct drm_display *display,
+			     struct drm_display_buffer *buffer,
+			     struct drm_display_plane_setup *plane_setup);
+int drm_display_buffer_teardown(struct drm_display *display,
+				struct drm_display_buffer *buffer);
+int drm_display_dynamic_resolution_update(struct drm_display *display,
+					  struct drm_display_plane_setup *plane_setup,
+					  unsigned int render_time_us);
+int drm_display_plane_pan(struct drm_display *display,
+			  struct drm_display_plane_setup *plane_setup,
+			  unsigned int x, unsigned int y);
+int drm_display_plane_move(struct drm_display *display,
+			   struct drm_display_plane_setup *plane_setup,
+			   int x, int y);
+int drm_display_plane_resize(struct drm_display *display,
+			     struct drm_display_plane_setup *plane_setup,
+			     unsigned int width, unsigned int height);
+int drm_display_cursor_move(struct drm_display *display, int x, int y);
+int drm_display_plane_rotation_set(struct drm_display *display,
+				   struct drm_display_plane_setup *plane_setup,
+				   uint32_t rotation);
+int drm_display_plane_zpos_set(struct drm_display *display,
+			       struct drm_display_plane_setup *plane_setup,
+			       uint64_t zpos);
+int drm_display_plane_alpha_set(struct drm_display *display,
+				struct drm_display_plane_setup *plane_setup,
+				uint16_t alpha);
+int drm_display_plane_blend_mode_set(struct drm_display *display,
+				     struct drm_display_plane_setup *plane_setup,
+				     enum drm_display_blend_mode blend_mode);
+int drm_display_gamma_lut_set(struct drm_display *display,
+			      double (*curve)(double value,
+					      unsigned int channel,
+					      void *private),
+			      void *private);
+int drm_display_degamma_lut_set(struct drm_display *display,
+				double (*curve)(double value,
+						unsigned int channel,
+						void *private),
+				void *private);
+int drm_display_ctm_set(struct drm_display *display, const double *matrix);
+int drm_display_writeback_capture(struct drm_display *display);
+struct drm_display_buffer *drm_display_writeback_wait(struct drm_display *display,
+						       int timeout);
+int drm_display_writeback_release(struct drm_display *display,
+				  struct drm_display_buffer *buffer);
 int drm_display_detach(struct drm_display *display,
 		       struct drm_display_plane_setup *plane_setup);
+bool drm_display_update_pending(struct drm_display *display);
+int drm_display_update(struct drm_display *display);
 int drm_display_page_flip(struct drm_display *display,
 			  struct drm_display_plane_setup *plane_setup,
 			  struct drm_display_buffer *buffer);
+int drm_display_page_flip_stage(struct drm_display *display,
+				struct drm_display_plane_setup *plane_setup,
+				struct drm_display_buffer *buffer);
 int drm_display_configure(struct drm_display *display,
 			  struct drm_display_plane_setup *plane_setup,
 			  struct drm_display_buffer *buffer);
+int drm_display_reconfigure(struct drm_display *display,
+			    struct drm_display_plane_setup *plane_setup,
+			    const struct drm_display_plane_setup *plane_setup_new);
+int drm_display_takeover(struct drm_display *display,
+			 struct drm_display_buffer *buffer);
 int drm_display_setup(struct drm_display *display);
 int drm_display_teardown(struct drm_display *display);
 int drm_display_probe(struct drm_display *display);
 int drm_display_open(struct drm_display *display);
+int drm_display_open_fd(struct drm_display *display, int fd);
 void drm_display_close(struct drm_display *display);
 
 #endif